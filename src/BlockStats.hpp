@@ -0,0 +1,121 @@
+#ifndef BLOCK_STATS_HPP
+#define BLOCK_STATS_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include "CpuDispatch.hpp"
+#include "Image.hpp"
+
+// Per-channel statistics of a block that can be merged from its sub-blocks.
+struct BlockStats {
+    long long count = 0;
+    long long sum[3] = {0, 0, 0};
+    long long sumSq[3] = {0, 0, 0};
+    uint8_t minV[3] = {255, 255, 255};
+    uint8_t maxV[3] = {0, 0, 0};
+    std::unique_ptr<std::array<uint32_t, 3 * 256>> hist;   // R, G, B histograms, only when requested
+
+    explicit BlockStats(bool withHistogram = false) {
+        if (withHistogram) hist.reset(new std::array<uint32_t, 3 * 256>());
+    }
+    BlockStats(BlockStats&&) = default;
+    BlockStats& operator=(BlockStats&&) = default;
+
+    void add(const RGB* run, int length) {
+        for (int k = 0; k < length; k++) {
+            const uint8_t c[3] = {run[k].r, run[k].g, run[k].b};
+            for (int ch = 0; ch < 3; ch++) {
+                sum[ch] += c[ch];
+                sumSq[ch] += c[ch] * c[ch];
+                minV[ch] = std::min(minV[ch], c[ch]);
+                maxV[ch] = std::max(maxV[ch], c[ch]);
+            }
+            if (hist) {
+                (*hist)[run[k].r]++;
+                (*hist)[256 + run[k].g]++;
+                (*hist)[512 + run[k].b]++;
+            }
+        }
+        count += length;
+    }
+
+    // Count, sums and sums of squares only.
+    void addMoments(const RGB* run, int length) {
+        count += length;
+        if (length >= KERNEL_MIN_RUN) {
+            pixelKernels().moments(run, length, sum, sumSq);
+            return;
+        }
+        long long s0 = 0, s1 = 0, s2 = 0, q0 = 0, q1 = 0, q2 = 0;
+        for (int k = 0; k < length; k++) {
+            int r = run[k].r, g = run[k].g, b = run[k].b;
+            s0 += r; s1 += g; s2 += b;
+            q0 += r * r; q1 += g * g; q2 += b * b;
+        }
+        sum[0] += s0; sum[1] += s1; sum[2] += s2;
+        sumSq[0] += q0; sumSq[1] += q1; sumSq[2] += q2;
+    }
+
+    // Count and per-channel min/max only.
+    void addRange(const RGB* run, int length) {
+        count += length;
+        if (length >= KERNEL_MIN_RUN) {
+            pixelKernels().range(run, length, minV, maxV);
+            return;
+        }
+        for (int k = 0; k < length; k++) {
+            minV[0] = std::min(minV[0], run[k].r);
+            maxV[0] = std::max(maxV[0], run[k].r);
+            minV[1] = std::min(minV[1], run[k].g);
+            maxV[1] = std::max(maxV[1], run[k].g);
+            minV[2] = std::min(minV[2], run[k].b);
+            maxV[2] = std::max(maxV[2], run[k].b);
+        }
+    }
+
+    // Count and histograms only; the histograms must have been requested.
+    void addHistogram(const RGB* run, int length) {
+        count += length;
+        for (int k = 0; k < length; k++) {
+            (*hist)[run[k].r]++;
+            (*hist)[256 + run[k].g]++;
+            (*hist)[512 + run[k].b]++;
+        }
+    }
+
+    // `pixels` pixels of a single color.
+    void addFlat(RGB color, long long pixels) {
+        const uint8_t c[3] = {color.r, color.g, color.b};
+        for (int ch = 0; ch < 3; ch++) {
+            sum[ch] += c[ch] * pixels;
+            sumSq[ch] += c[ch] * c[ch] * pixels;
+            minV[ch] = std::min(minV[ch], c[ch]);
+            maxV[ch] = std::max(maxV[ch], c[ch]);
+            if (hist) (*hist)[ch * 256 + c[ch]] += static_cast<uint32_t>(pixels);
+        }
+        count += pixels;
+    }
+
+    void merge(const BlockStats& other) {
+        count += other.count;
+        for (int ch = 0; ch < 3; ch++) {
+            sum[ch] += other.sum[ch];
+            sumSq[ch] += other.sumSq[ch];
+            minV[ch] = std::min(minV[ch], other.minV[ch]);
+            maxV[ch] = std::max(maxV[ch], other.maxV[ch]);
+        }
+        if (hist && other.hist) {
+            for (size_t i = 0; i < hist->size(); i++) (*hist)[i] += (*other.hist)[i];
+        }
+    }
+
+    // Truncated mean, matching QuadTree::calculateAverage.
+    RGB average() const {
+        if (count == 0) return RGB();
+        return RGB(static_cast<uint8_t>(sum[0] / count), static_cast<uint8_t>(sum[1] / count), static_cast<uint8_t>(sum[2] / count));
+    }
+};
+
+#endif
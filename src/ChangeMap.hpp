@@ -0,0 +1,82 @@
+#ifndef CHANGE_MAP_HPP
+#define CHANGE_MAP_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "PixelStore.hpp"
+#include "QuadNode.hpp"
+
+// Tiles that differ between the stored frame and the next one, with a summed-area table over
+// the tile grid so that asking whether a block touches a changed tile costs four lookups.
+class ChangeMap {
+public:
+    static const int TILE_SHIFT = 4;   // 16x16 tiles
+
+private:
+    int width = 0;
+    int height = 0;
+    int tilesX = 0;
+    int tilesY = 0;
+    std::vector<uint8_t> changed;
+    std::vector<int> table;   // (tilesX + 1) x (tilesY + 1) prefix counts of changed tiles
+
+public:
+    // frame must have the stored image's size.
+    void build(const PixelStore& pixels, const std::vector<std::vector<RGB>>& frame) {
+        width = pixels.getWidth();
+        height = pixels.getHeight();
+        tilesX = (width + (1 << TILE_SHIFT) - 1) >> TILE_SHIFT;
+        tilesY = (height + (1 << TILE_SHIFT) - 1) >> TILE_SHIFT;
+        changed.assign(static_cast<size_t>(tilesX) * tilesY, 0);
+        for (int y = 0; y < height; y++) {
+            uint8_t* row = &changed[static_cast<size_t>(y >> TILE_SHIFT) * tilesX];
+            for (int tx = 0; tx < tilesX; tx++) {
+                if (row[tx]) continue;
+                int x0 = tx << TILE_SHIFT;
+                row[tx] = !pixels.rowEquals(frame[y], x0, y, std::min(width - x0, 1 << TILE_SHIFT));
+            }
+        }
+        table.assign(static_cast<size_t>(tilesX + 1) * (tilesY + 1), 0);
+        for (int ty = 0; ty < tilesY; ty++) {
+            int rowCount = 0;
+            for (int tx = 0; tx < tilesX; tx++) {
+                rowCount += changed[static_cast<size_t>(ty) * tilesX + tx];
+                table[static_cast<size_t>(ty + 1) * (tilesX + 1) + tx + 1] = table[static_cast<size_t>(ty) * (tilesX + 1) + tx + 1] + rowCount;
+            }
+        }
+    }
+
+    int changedTiles() const { return table.empty() ? 0 : table.back(); }
+    int totalTiles() const { return tilesX * tilesY; }
+
+    // Whether any changed tile overlaps the block (which lies inside the image).
+    bool touches(const Rect& rect) const {
+        int tx0 = rect.x >> TILE_SHIFT, ty0 = rect.y >> TILE_SHIFT;
+        int tx1 = ((rect.x + rect.width - 1) >> TILE_SHIFT) + 1;
+        int ty1 = ((rect.y + rect.height - 1) >> TILE_SHIFT) + 1;
+        size_t stride = tilesX + 1;
+        return table[ty1 * stride + tx1] - table[ty0 * stride + tx1] - table[ty1 * stride + tx0] + table[ty0 * stride + tx0] > 0;
+    }
+
+    // Calls fn(const Rect&) for every horizontal run of changed tiles, clipped to the image.
+    template <typename Fn>
+    void forEachChangedRun(Fn fn) const {
+        for (int ty = 0; ty < tilesY; ty++) {
+            const uint8_t* row = &changed[static_cast<size_t>(ty) * tilesX];
+            for (int tx = 0; tx < tilesX;) {
+                if (!row[tx]) {
+                    tx++;
+                    continue;
+                }
+                int end = tx;
+                while (end < tilesX && row[end]) end++;
+                int x = tx << TILE_SHIFT, y = ty << TILE_SHIFT;
+                fn(Rect{x, y, std::min(width, end << TILE_SHIFT) - x, std::min(height, (ty + 1) << TILE_SHIFT) - y});
+                tx = end;
+            }
+        }
+    }
+};
+
+#endif
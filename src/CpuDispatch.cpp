@@ -0,0 +1,521 @@
+#include "CpuDispatch.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// 64-bit only: the reductions use 64-bit lane extracts; 32-bit x86 gets the scalar kernels.
+#if defined(__GNUC__) && defined(__x86_64__)
+#define QT_X86_DISPATCH 1
+#define QT_TARGET(isa) __attribute__((target(isa)))
+#define QT_ALWAYS_INLINE inline __attribute__((always_inline))
+#include <immintrin.h>
+#else
+#define QT_ALWAYS_INLINE inline
+#endif
+
+static_assert(sizeof(RGB) == 3, "pixel kernels treat runs as packed RGB bytes");
+
+// The vector kernels walk a run as a byte stream, a whole number of pixels per iteration, so
+// every vector lane always sees the same channel: byte p of an iteration holds channel p % 3.
+// Lanes are folded into channels once at the end.
+namespace {
+
+const int MAX_ITERATIONS = 1 << 16;   // keeps 32-bit lane sums of squares (<= 65025 each) from overflowing
+
+// count is a multiple of 3.
+QT_ALWAYS_INLINE void foldLanes(const uint32_t* lanes, int count, long long channels[3]) {
+    long long c0 = 0, c1 = 0, c2 = 0;
+    for (int p = 0; p < count; p += 3) {
+        c0 += lanes[p];
+        c1 += lanes[p + 1];
+        c2 += lanes[p + 2];
+    }
+    channels[0] += c0;
+    channels[1] += c1;
+    channels[2] += c2;
+}
+
+QT_ALWAYS_INLINE void foldRange(const uint8_t* lo, const uint8_t* hi, int count, uint8_t minV[3], uint8_t maxV[3]) {
+    for (int p = 0; p < count; p += 3) {
+        for (int ch = 0; ch < 3; ch++) {
+            minV[ch] = std::min(minV[ch], lo[p + ch]);
+            maxV[ch] = std::max(maxV[ch], hi[p + ch]);
+        }
+    }
+}
+
+QT_ALWAYS_INLINE void fillPattern(uint8_t* pattern, int bytes, RGB color) {
+    for (int p = 0; p < bytes; p += 3) {
+        pattern[p] = color.r;
+        pattern[p + 1] = color.g;
+        pattern[p + 2] = color.b;
+    }
+}
+
+// Scalar loops, inlined into every vector kernel for its tail so that the tail is compiled
+// for the same target.
+
+QT_ALWAYS_INLINE void tailMoments(const RGB* run, int length, long long sum[3], long long sumSq[3]) {
+    long long s0 = 0, s1 = 0, s2 = 0, q0 = 0, q1 = 0, q2 = 0;
+    for (int k = 0; k < length; k++) {
+        int r = run[k].r, g = run[k].g, b = run[k].b;
+        s0 += r; s1 += g; s2 += b;
+        q0 += r * r; q1 += g * g; q2 += b * b;
+    }
+    sum[0] += s0; sum[1] += s1; sum[2] += s2;
+    sumSq[0] += q0; sumSq[1] += q1; sumSq[2] += q2;
+}
+
+QT_ALWAYS_INLINE void tailRange(const RGB* run, int length, uint8_t minV[3], uint8_t maxV[3]) {
+    // Locals, since stores through uint8_t pointers could alias the run.
+    uint8_t lo0 = minV[0], lo1 = minV[1], lo2 = minV[2];
+    uint8_t hi0 = maxV[0], hi1 = maxV[1], hi2 = maxV[2];
+    for (int k = 0; k < length; k++) {
+        lo0 = std::min(lo0, run[k].r);
+        hi0 = std::max(hi0, run[k].r);
+        lo1 = std::min(lo1, run[k].g);
+        hi1 = std::max(hi1, run[k].g);
+        lo2 = std::min(lo2, run[k].b);
+        hi2 = std::max(hi2, run[k].b);
+    }
+    minV[0] = lo0; minV[1] = lo1; minV[2] = lo2;
+    maxV[0] = hi0; maxV[1] = hi1; maxV[2] = hi2;
+}
+
+QT_ALWAYS_INLINE long long tailAbsDeviation(const RGB* run, int length, RGB mean) {
+    long long total = 0;
+    for (int k = 0; k < length; k++) {
+        total += std::abs(run[k].r - mean.r) + std::abs(run[k].g - mean.g) + std::abs(run[k].b - mean.b);
+    }
+    return total;
+}
+
+QT_ALWAYS_INLINE void tailFill(RGB* out, int length, RGB color) {
+    std::fill(out, out + length, color);
+}
+
+QT_ALWAYS_INLINE long long tailPaintRGBA(uint8_t* out, int length, RGB color) {
+    long long changed = 0;
+    for (int k = 0; k < length; k++, out += 4) {
+        if (out[0] != color.r || out[1] != color.g || out[2] != color.b) {
+            out[0] = color.r;
+            out[1] = color.g;
+            out[2] = color.b;
+            changed++;
+        }
+    }
+    return changed;
+}
+
+void scalarMoments(const RGB* run, int length, long long sum[3], long long sumSq[3]) { tailMoments(run, length, sum, sumSq); }
+void scalarRange(const RGB* run, int length, uint8_t minV[3], uint8_t maxV[3]) { tailRange(run, length, minV, maxV); }
+long long scalarAbsDeviation(const RGB* run, int length, RGB mean) { return tailAbsDeviation(run, length, mean); }
+void scalarFill(RGB* out, int length, RGB color) { tailFill(out, length, color); }
+long long scalarPaintRGBA(uint8_t* out, int length, RGB color) { return tailPaintRGBA(out, length, color); }
+
+const PixelKernels scalarKernels = {scalarMoments, scalarRange, scalarAbsDeviation, scalarFill, scalarPaintRGBA};
+
+#ifdef QT_X86_DISPATCH
+
+QT_ALWAYS_INLINE uint32_t rgbaMaskWord(RGB color, uint32_t* mask) {
+    const uint8_t colorBytes[4] = {color.r, color.g, color.b, 0};
+    const uint8_t maskBytes[4] = {255, 255, 255, 0};
+    uint32_t word;
+    std::memcpy(&word, colorBytes, 4);
+    std::memcpy(mask, maskBytes, 4);
+    return word;
+}
+
+// SSE4.2: 4 pixels (three 4-lane groups) per iteration for moments, 16 pixels for the byte kernels.
+
+QT_TARGET("sse4.2") void sse42Moments(const RGB* run, int length, long long sum[3], long long sumSq[3]) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(run);
+    int k = 0;
+    while (length - k >= 4) {
+        __m128i s[3], q[3];
+        for (int g = 0; g < 3; g++) s[g] = q[g] = _mm_setzero_si128();
+        int end = k + std::min((length - k) / 4, MAX_ITERATIONS) * 4;
+        for (; k < end; k += 4) {
+            const uint8_t* p = bytes + 3 * k;
+            for (int g = 0; g < 3; g++) {
+                int word;
+                std::memcpy(&word, p + 4 * g, 4);
+                __m128i v = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(word));
+                s[g] = _mm_add_epi32(s[g], v);
+                q[g] = _mm_add_epi32(q[g], _mm_mullo_epi32(v, v));
+            }
+        }
+        uint32_t sumLanes[12], sqLanes[12];
+        for (int g = 0; g < 3; g++) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(sumLanes + 4 * g), s[g]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(sqLanes + 4 * g), q[g]);
+        }
+        foldLanes(sumLanes, 12, sum);
+        foldLanes(sqLanes, 12, sumSq);
+    }
+    tailMoments(run + k, length - k, sum, sumSq);
+}
+
+QT_TARGET("sse4.2") void sse42Range(const RGB* run, int length, uint8_t minV[3], uint8_t maxV[3]) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(run);
+    int k = 0;
+    if (length >= 16) {
+        __m128i lo[3], hi[3];
+        for (int g = 0; g < 3; g++) {
+            lo[g] = _mm_set1_epi8(static_cast<char>(255));
+            hi[g] = _mm_setzero_si128();
+        }
+        for (; k + 16 <= length; k += 16) {
+            const uint8_t* p = bytes + 3 * k;
+            for (int g = 0; g < 3; g++) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * g));
+                lo[g] = _mm_min_epu8(lo[g], v);
+                hi[g] = _mm_max_epu8(hi[g], v);
+            }
+        }
+        uint8_t loBytes[48], hiBytes[48];
+        for (int g = 0; g < 3; g++) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(loBytes + 16 * g), lo[g]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(hiBytes + 16 * g), hi[g]);
+        }
+        foldRange(loBytes, hiBytes, 48, minV, maxV);
+    }
+    tailRange(run + k, length - k, minV, maxV);
+}
+
+QT_TARGET("sse4.2") long long sse42AbsDeviation(const RGB* run, int length, RGB mean) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(run);
+    uint8_t pattern[48];
+    fillPattern(pattern, 48, mean);
+    __m128i m[3], acc = _mm_setzero_si128();
+    for (int g = 0; g < 3; g++) m[g] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern + 16 * g));
+    int k = 0;
+    for (; k + 16 <= length; k += 16) {
+        const uint8_t* p = bytes + 3 * k;
+        for (int g = 0; g < 3; g++) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * g));
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(v, m[g]));
+        }
+    }
+    long long total = _mm_cvtsi128_si64(acc) + _mm_extract_epi64(acc, 1);
+    return total + tailAbsDeviation(run + k, length - k, mean);
+}
+
+QT_TARGET("sse4.2") void sse42Fill(RGB* out, int length, RGB color) {
+    uint8_t pattern[48];
+    fillPattern(pattern, 48, color);
+    __m128i m[3];
+    for (int g = 0; g < 3; g++) m[g] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern + 16 * g));
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(out);
+    int k = 0;
+    for (; k + 16 <= length; k += 16) {
+        for (int g = 0; g < 3; g++) _mm_storeu_si128(reinterpret_cast<__m128i*>(bytes + 3 * k + 16 * g), m[g]);
+    }
+    tailFill(out + k, length - k, color);
+}
+
+QT_TARGET("sse4.2") long long sse42PaintRGBA(uint8_t* out, int length, RGB color) {
+    uint32_t maskWord;
+    uint32_t colorWord = rgbaMaskWord(color, &maskWord);
+    __m128i want = _mm_set1_epi32(static_cast<int>(colorWord));
+    __m128i mask = _mm_set1_epi32(static_cast<int>(maskWord));
+    long long changed = 0;
+    int k = 0;
+    for (; k + 4 <= length; k += 4) {
+        __m128i* p = reinterpret_cast<__m128i*>(out + 4 * k);
+        __m128i v = _mm_loadu_si128(p);
+        __m128i same = _mm_cmpeq_epi32(_mm_and_si128(v, mask), want);
+        changed += 4 - __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(same)));
+        _mm_storeu_si128(p, _mm_or_si128(_mm_andnot_si128(mask, v), want));
+    }
+    return changed + tailPaintRGBA(out + 4 * k, length - k, color);
+}
+
+// AVX2: 8 pixels per iteration for moments, 32 for the byte kernels.
+
+QT_TARGET("avx2") void avx2Moments(const RGB* run, int length, long long sum[3], long long sumSq[3]) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(run);
+    int k = 0;
+    while (length - k >= 8) {
+        __m256i s[3], q[3];
+        for (int g = 0; g < 3; g++) s[g] = q[g] = _mm256_setzero_si256();
+        int end = k + std::min((length - k) / 8, MAX_ITERATIONS) * 8;
+        for (; k < end; k += 8) {
+            const uint8_t* p = bytes + 3 * k;
+            for (int g = 0; g < 3; g++) {
+                __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p + 8 * g)));
+                s[g] = _mm256_add_epi32(s[g], v);
+                q[g] = _mm256_add_epi32(q[g], _mm256_mullo_epi32(v, v));
+            }
+        }
+        uint32_t sumLanes[24], sqLanes[24];
+        for (int g = 0; g < 3; g++) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(sumLanes + 8 * g), s[g]);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(sqLanes + 8 * g), q[g]);
+        }
+        foldLanes(sumLanes, 24, sum);
+        foldLanes(sqLanes, 24, sumSq);
+    }
+    tailMoments(run + k, length - k, sum, sumSq);
+}
+
+QT_TARGET("avx2") void avx2Range(const RGB* run, int length, uint8_t minV[3], uint8_t maxV[3]) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(run);
+    int k = 0;
+    if (length >= 32) {
+        __m256i lo[3], hi[3];
+        for (int g = 0; g < 3; g++) {
+            lo[g] = _mm256_set1_epi8(static_cast<char>(255));
+            hi[g] = _mm256_setzero_si256();
+        }
+        for (; k + 32 <= length; k += 32) {
+            const uint8_t* p = bytes + 3 * k;
+            for (int g = 0; g < 3; g++) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32 * g));
+                lo[g] = _mm256_min_epu8(lo[g], v);
+                hi[g] = _mm256_max_epu8(hi[g], v);
+            }
+        }
+        uint8_t loBytes[96], hiBytes[96];
+        for (int g = 0; g < 3; g++) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(loBytes + 32 * g), lo[g]);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(hiBytes + 32 * g), hi[g]);
+        }
+        foldRange(loBytes, hiBytes, 96, minV, maxV);
+    }
+    tailRange(run + k, length - k, minV, maxV);
+}
+
+QT_TARGET("avx2") long long avx2AbsDeviation(const RGB* run, int length, RGB mean) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(run);
+    uint8_t pattern[96];
+    fillPattern(pattern, 96, mean);
+    __m256i m[3], acc = _mm256_setzero_si256();
+    for (int g = 0; g < 3; g++) m[g] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pattern + 32 * g));
+    int k = 0;
+    for (; k + 32 <= length; k += 32) {
+        const uint8_t* p = bytes + 3 * k;
+        for (int g = 0; g < 3; g++) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32 * g));
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, m[g]));
+        }
+    }
+    long long lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + tailAbsDeviation(run + k, length - k, mean);
+}
+
+QT_TARGET("avx2") void avx2Fill(RGB* out, int length, RGB color) {
+    uint8_t pattern[96];
+    fillPattern(pattern, 96, color);
+    __m256i m[3];
+    for (int g = 0; g < 3; g++) m[g] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pattern + 32 * g));
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(out);
+    int k = 0;
+    for (; k + 32 <= length; k += 32) {
+        for (int g = 0; g < 3; g++) _mm256_storeu_si256(reinterpret_cast<__m256i*>(bytes + 3 * k + 32 * g), m[g]);
+    }
+    tailFill(out + k, length - k, color);
+}
+
+QT_TARGET("avx2") long long avx2PaintRGBA(uint8_t* out, int length, RGB color) {
+    uint32_t maskWord;
+    uint32_t colorWord = rgbaMaskWord(color, &maskWord);
+    __m256i want = _mm256_set1_epi32(static_cast<int>(colorWord));
+    __m256i mask = _mm256_set1_epi32(static_cast<int>(maskWord));
+    long long changed = 0;
+    int k = 0;
+    for (; k + 8 <= length; k += 8) {
+        __m256i* p = reinterpret_cast<__m256i*>(out + 4 * k);
+        __m256i v = _mm256_loadu_si256(p);
+        __m256i same = _mm256_cmpeq_epi32(_mm256_and_si256(v, mask), want);
+        changed += 8 - __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(same)));
+        _mm256_storeu_si256(p, _mm256_or_si256(_mm256_andnot_si256(mask, v), want));
+    }
+    return changed + tailPaintRGBA(out + 4 * k, length - k, color);
+}
+
+// AVX-512 (F + BW): 16 pixels per iteration for moments, 64 for the byte kernels.
+
+QT_TARGET("avx512f,avx512bw") void avx512Moments(const RGB* run, int length, long long sum[3], long long sumSq[3]) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(run);
+    int k = 0;
+    while (length - k >= 16) {
+        __m512i s[3], q[3];
+        for (int g = 0; g < 3; g++) s[g] = q[g] = _mm512_setzero_si512();
+        int end = k + std::min((length - k) / 16, MAX_ITERATIONS) * 16;
+        for (; k < end; k += 16) {
+            const uint8_t* p = bytes + 3 * k;
+            for (int g = 0; g < 3; g++) {
+                __m512i v = _mm512_maskz_cvtepu8_epi32(0xFFFF, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * g)));
+                s[g] = _mm512_add_epi32(s[g], v);
+                q[g] = _mm512_add_epi32(q[g], _mm512_mullo_epi32(v, v));
+            }
+        }
+        uint32_t sumLanes[48], sqLanes[48];
+        for (int g = 0; g < 3; g++) {
+            _mm512_storeu_si512(sumLanes + 16 * g, s[g]);
+            _mm512_storeu_si512(sqLanes + 16 * g, q[g]);
+        }
+        foldLanes(sumLanes, 48, sum);
+        foldLanes(sqLanes, 48, sumSq);
+    }
+    tailMoments(run + k, length - k, sum, sumSq);
+}
+
+QT_TARGET("avx512f,avx512bw") void avx512Range(const RGB* run, int length, uint8_t minV[3], uint8_t maxV[3]) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(run);
+    int k = 0;
+    if (length >= 64) {
+        __m512i lo[3], hi[3];
+        for (int g = 0; g < 3; g++) {
+            lo[g] = _mm512_set1_epi8(static_cast<char>(255));
+            hi[g] = _mm512_setzero_si512();
+        }
+        for (; k + 64 <= length; k += 64) {
+            const uint8_t* p = bytes + 3 * k;
+            for (int g = 0; g < 3; g++) {
+                __m512i v = _mm512_loadu_si512(p + 64 * g);
+                lo[g] = _mm512_min_epu8(lo[g], v);
+                hi[g] = _mm512_max_epu8(hi[g], v);
+            }
+        }
+        uint8_t loBytes[192], hiBytes[192];
+        for (int g = 0; g < 3; g++) {
+            _mm512_storeu_si512(loBytes + 64 * g, lo[g]);
+            _mm512_storeu_si512(hiBytes + 64 * g, hi[g]);
+        }
+        foldRange(loBytes, hiBytes, 192, minV, maxV);
+    }
+    tailRange(run + k, length - k, minV, maxV);
+}
+
+QT_TARGET("avx512f,avx512bw") long long avx512AbsDeviation(const RGB* run, int length, RGB mean) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(run);
+    uint8_t pattern[192];
+    fillPattern(pattern, 192, mean);
+    __m512i m[3], acc = _mm512_setzero_si512();
+    for (int g = 0; g < 3; g++) m[g] = _mm512_loadu_si512(pattern + 64 * g);
+    int k = 0;
+    for (; k + 64 <= length; k += 64) {
+        const uint8_t* p = bytes + 3 * k;
+        for (int g = 0; g < 3; g++) {
+            __m512i v = _mm512_loadu_si512(p + 64 * g);
+            acc = _mm512_add_epi64(acc, _mm512_sad_epu8(v, m[g]));
+        }
+    }
+    long long lanes[8];
+    _mm512_storeu_si512(lanes, acc);
+    long long total = 0;
+    for (int i = 0; i < 8; i++) total += lanes[i];
+    return total + tailAbsDeviation(run + k, length - k, mean);
+}
+
+QT_TARGET("avx512f,avx512bw") void avx512Fill(RGB* out, int length, RGB color) {
+    uint8_t pattern[192];
+    fillPattern(pattern, 192, color);
+    __m512i m[3];
+    for (int g = 0; g < 3; g++) m[g] = _mm512_loadu_si512(pattern + 64 * g);
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(out);
+    int k = 0;
+    for (; k + 64 <= length; k += 64) {
+        for (int g = 0; g < 3; g++) _mm512_storeu_si512(bytes + 3 * k + 64 * g, m[g]);
+    }
+    tailFill(out + k, length - k, color);
+}
+
+QT_TARGET("avx512f,avx512bw") long long avx512PaintRGBA(uint8_t* out, int length, RGB color) {
+    uint32_t maskWord;
+    uint32_t colorWord = rgbaMaskWord(color, &maskWord);
+    __m512i want = _mm512_set1_epi32(static_cast<int>(colorWord));
+    __m512i mask = _mm512_set1_epi32(static_cast<int>(maskWord));
+    __m512i keep = _mm512_set1_epi32(static_cast<int>(~maskWord));
+    long long changed = 0;
+    int k = 0;
+    for (; k + 16 <= length; k += 16) {
+        uint8_t* p = out + 4 * k;
+        __m512i v = _mm512_loadu_si512(p);
+        __mmask16 same = _mm512_cmpeq_epi32_mask(_mm512_and_si512(v, mask), want);
+        changed += 16 - __builtin_popcount(same);
+        _mm512_storeu_si512(p, _mm512_or_si512(_mm512_and_si512(v, keep), want));
+    }
+    return changed + tailPaintRGBA(out + 4 * k, length - k, color);
+}
+
+const PixelKernels sse42Kernels = {sse42Moments, sse42Range, sse42AbsDeviation, sse42Fill, sse42PaintRGBA};
+const PixelKernels avx2Kernels = {avx2Moments, avx2Range, avx2AbsDeviation, avx2Fill, avx2PaintRGBA};
+const PixelKernels avx512Kernels = {avx512Moments, avx512Range, avx512AbsDeviation, avx512Fill, avx512PaintRGBA};
+
+#endif
+
+const PixelKernels& kernelsFor(SimdLevel level) {
+#ifdef QT_X86_DISPATCH
+    switch (level) {
+        case SimdLevel::AVX512: return avx512Kernels;
+        case SimdLevel::AVX2: return avx2Kernels;
+        case SimdLevel::SSE42: return sse42Kernels;
+        default: break;
+    }
+#endif
+    (void)level;
+    return scalarKernels;
+}
+
+struct ActiveKernels {
+    SimdLevel level;
+    const PixelKernels* kernels;
+};
+
+ActiveKernels& active() {
+    static ActiveKernels current = []() {
+        SimdLevel level = detectSimdLevel();
+        return ActiveKernels{level, &kernelsFor(level)};
+    }();
+    return current;
+}
+
+}
+
+SimdLevel detectSimdLevel() {
+#ifdef QT_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) return SimdLevel::AVX512;
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return SimdLevel::SSE42;
+#endif
+    return SimdLevel::Scalar;
+}
+
+SimdLevel getSimdLevel() {
+    return active().level;
+}
+
+bool setSimdLevel(SimdLevel level) {
+    if (level > detectSimdLevel()) return false;
+    active() = {level, &kernelsFor(level)};
+    return true;
+}
+
+bool parseSimdLevel(const std::string& name, SimdLevel& level) {
+    const SimdLevel levels[] = {SimdLevel::Scalar, SimdLevel::SSE42, SimdLevel::AVX2, SimdLevel::AVX512};
+    for (SimdLevel candidate : levels) {
+        if (name == simdLevelName(candidate)) {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::SSE42: return "sse4.2";
+        case SimdLevel::AVX2: return "avx2";
+        case SimdLevel::AVX512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+const PixelKernels& pixelKernels() {
+    return *active().kernels;
+}
@@ -0,0 +1,37 @@
+#ifndef CPU_DISPATCH_HPP
+#define CPU_DISPATCH_HPP
+
+#include <cstdint>
+#include <string>
+#include "Image.hpp"
+
+// Instruction-set levels the pixel kernels are compiled for. The best level supported by the
+// CPU is picked on first use; setSimdLevel overrides it (e.g. to test the fallbacks).
+enum class SimdLevel {
+    Scalar,
+    SSE42,
+    AVX2,
+    AVX512
+};
+
+SimdLevel detectSimdLevel();
+SimdLevel getSimdLevel();
+bool setSimdLevel(SimdLevel level);   // false if the CPU lacks the level
+bool parseSimdLevel(const std::string& name, SimdLevel& level);
+const char* simdLevelName(SimdLevel level);
+
+// Runs shorter than this are cheaper to handle inline than through a kernel pointer.
+const int KERNEL_MIN_RUN = 32;
+
+// Kernels over contiguous pixel runs, one table per instruction-set level.
+struct PixelKernels {
+    void (*moments)(const RGB* run, int length, long long sum[3], long long sumSq[3]);
+    void (*range)(const RGB* run, int length, uint8_t minV[3], uint8_t maxV[3]);
+    long long (*absDeviation)(const RGB* run, int length, RGB mean);   // sum over all channels
+    void (*fill)(RGB* out, int length, RGB color);
+    long long (*paintRGBA)(uint8_t* out, int length, RGB color);       // returns pixels changed, alpha kept
+};
+
+const PixelKernels& pixelKernels();
+
+#endif
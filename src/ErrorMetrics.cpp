@@ -0,0 +1,136 @@
+#include "ErrorMetrics.hpp"
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <vector>
+
+// Mean SSIM between the block and a flat leaf of its average color c, over 8x8 windows with
+// a stride of 4 (the last window in each direction is flush with the block edge). With a flat
+// candidate, sigma_y and sigma_xy vanish and the cross term is c * sum(x), so every window
+// needs only the integral sums of x and x^2. The window scores are plain scalar double code
+// and do not go through the CpuDispatch kernels.
+double windowedSSIM(const IntegralImage& integral, int imageWidth, int imageHeight, int x, int y, int width, int height) {
+    const int WINDOW = 8;
+    const int STEP = 4;
+    const double C1 = (0.01 * 255.0) * (0.01 * 255.0);
+    const double C2 = (0.03 * 255.0) * (0.03 * 255.0);
+
+    int x0 = std::max(0, x), y0 = std::max(0, y);
+    int x1 = std::min(imageWidth, x + width), y1 = std::min(imageHeight, y + height);
+    if (x0 >= x1 || y0 >= y1) return 1.0;
+
+    long long n = static_cast<long long>(x1 - x0) * (y1 - y0);
+    double c[3];
+    for (int ch = 0; ch < 3; ch++) {
+        c[ch] = static_cast<double>(integral.rectSum(ch, x0, y0, x1, y1) / n);
+    }
+
+    int winW = std::min(WINDOW, x1 - x0);
+    int winH = std::min(WINDOW, y1 - y0);
+    double m = static_cast<double>(winW) * winH;
+    double invM = 1.0 / m;
+    double invM1 = m > 1 ? 1.0 / (m - 1) : 0.0;
+    const uint32_t* S[3] = {integral.sums(0), integral.sums(1), integral.sums(2)};
+    const uint32_t* Q[3] = {integral.sumsOfSquares(0), integral.sumsOfSquares(1), integral.sumsOfSquares(2)};
+
+    // A window crosses at most one strip boundary; the second pair of rows is used only then.
+    size_t top[2], bottom[2];
+    auto windowScore = [&](auto crossesStrip, int wx) {
+        double score = 0;
+        for (int ch = 0; ch < 3; ch++) {
+            uint32_t sBox = IntegralImage::box(S[ch], top[0], bottom[0], wx, wx + winW);
+            uint32_t qBox = IntegralImage::box(Q[ch], top[0], bottom[0], wx, wx + winW);
+            if constexpr (decltype(crossesStrip)::value) {
+                sBox += IntegralImage::box(S[ch], top[1], bottom[1], wx, wx + winW);
+                qBox += IntegralImage::box(Q[ch], top[1], bottom[1], wx, wx + winW);
+            }
+            double s = static_cast<double>(sBox);
+            double q = static_cast<double>(qBox);
+            double mu = s * invM;
+            double var = (q - s * mu) * invM1;
+            score += ((2.0 * mu * c[ch] + C1) * C2) / ((mu * mu + c[ch] * c[ch] + C1) * (var + C2));
+        }
+        return score;
+    };
+
+    int stepsX = (x1 - x0 - winW) / STEP + 1;
+    bool flushX = (x1 - x0 - winW) % STEP != 0;
+    auto windowRow = [&](auto crossesStrip) {
+        // Four interleaved scalar sums, so consecutive window scores don't wait on one add chain.
+        double acc[4] = {0, 0, 0, 0};
+        int i = 0;
+        for (; i + 4 <= stepsX; i += 4) {
+            for (int lane = 0; lane < 4; lane++) acc[lane] += windowScore(crossesStrip, x0 + (i + lane) * STEP);
+        }
+        for (; i < stepsX; i++) acc[0] += windowScore(crossesStrip, x0 + i * STEP);
+        if (flushX) acc[1] += windowScore(crossesStrip, x1 - winW);
+        return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+    };
+
+    double total = 0;
+    long long windows = 0;
+    for (int wy = y0; ; wy += STEP) {
+        if (wy + winH > y1) wy = y1 - winH;
+        int parts = 0;
+        integral.forEachStrip(wy, wy + winH, [&](size_t stripTop, size_t stripBottom) {
+            top[parts] = stripTop;
+            bottom[parts] = stripBottom;
+            parts++;
+        });
+        total += parts == 1 ? windowRow(std::false_type()) : windowRow(std::true_type());
+        windows += stepsX + (flushX ? 1 : 0);
+        if (wy + winH >= y1) break;
+    }
+
+    double ssim = total / (3.0 * windows);
+    return std::max(-1.0, std::min(1.0, ssim));
+}
+
+// n * log2(n) for small counts, so that entropy is computed from integer counts:
+// H = log2(N) - sum(c * log2(c)) / N. The table stays at 32 KB so that it lives in L1 next
+// to the histograms; larger counts only come from large blocks and are computed directly.
+static double nLog2n(uint32_t count) {
+    static const int TABLE_SIZE = 1 << 12;
+    static const std::vector<double> table = []() {
+        std::vector<double> values(TABLE_SIZE, 0.0);
+        for (int c = 1; c < TABLE_SIZE; c++) values[c] = c * std::log2(static_cast<double>(c));
+        return values;
+    }();
+    return count < TABLE_SIZE ? table[count] : count * std::log2(static_cast<double>(count));
+}
+
+// Mean entropy of the three 256-bin channel histograms in hist.
+double entropyFromCounts(const uint32_t* hist, long long total) {
+    if (total == 0) return 0.0;
+    double weighted = 0;
+    for (int i = 0; i < 3 * 256; i++) weighted += nLog2n(hist[i]);
+    double n = static_cast<double>(total);
+    return std::max(0.0, 3.0 * std::log2(n) - weighted / n) / 3.0;
+}
+
+double entropyFromValues(uint8_t* values, int n) {
+    if (n == 0) return 0.0;
+    // Sorting beats clearing the 768 bins only for a handful of values.
+    if (n > 16) {
+        uint32_t hist[3 * 256] = {};
+        for (int ch = 0; ch < 3; ch++) {
+            for (int i = 0; i < n; i++) hist[ch * 256 + values[ch * n + i]]++;
+        }
+        return entropyFromCounts(hist, n);
+    }
+    double weighted = 0;
+    for (int ch = 0; ch < 3; ch++) {
+        uint8_t* channel = values + ch * n;
+        std::sort(channel, channel + n);
+        // Runs of equal values in ascending order, the same terms and order as the histogram sum.
+        int start = 0;
+        for (int i = 1; i <= n; i++) {
+            if (i == n || channel[i] != channel[start]) {
+                weighted += nLog2n(i - start);
+                start = i;
+            }
+        }
+    }
+    double total = static_cast<double>(n);
+    return std::max(0.0, 3.0 * std::log2(total) - weighted / total) / 3.0;
+}
@@ -0,0 +1,478 @@
+#ifndef ERROR_METRICS_HPP
+#define ERROR_METRICS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include "BlockStats.hpp"
+#include "CpuDispatch.hpp"
+#include "IntegralImage.hpp"
+#include "Parallel.hpp"
+#include "PixelStore.hpp"
+#include "SmallBlock.hpp"
+
+// Compile-time error-method policies. Each metric defines how a block's error is measured,
+// which side of the threshold forces a split and, where possible, how to decide early, so the
+// builders templated on a metric contain no per-block switch.
+
+// What a metric may read besides the block geometry.
+struct MetricInput {
+    const PixelStore& pixels;
+    const IntegralImage& integral;   // only built for windowed SSIM
+};
+
+// Truncated mean color of a block clipped to the image.
+inline RGB blockAverage(const PixelStore& pixels, int x, int y, int width, int height) {
+    long long r = 0, g = 0, b = 0;
+    long long count = 0;
+    pixels.forEachRun(x, y, width, height, [&](const RGB* run, int length) {
+        // Per-run locals: the captured totals could alias the pixel bytes and stay in memory.
+        long long runR = 0, runG = 0, runB = 0;
+        for (int k = 0; k < length; k++) {
+            runR += run[k].r;
+            runG += run[k].g;
+            runB += run[k].b;
+        }
+        r += runR;
+        g += runG;
+        b += runB;
+        count += length;
+    });
+    if (count == 0) return RGB();
+    return RGB(static_cast<uint8_t>(r / count), static_cast<uint8_t>(g / count), static_cast<uint8_t>(b / count));
+}
+
+// Calls fn(band, bandY, bandHeight) concurrently for up to `bands` row bands of the block
+// clipped to the image.
+template <typename Fn>
+void forEachRowBand(const PixelStore& pixels, int y, int height, int bands, Fn fn) {
+    int y0 = std::max(0, y), y1 = std::min(pixels.getHeight(), y + height);
+    if (y0 >= y1) return;
+    parallelChunks(y1 - y0, bands, [&](size_t band, size_t begin, size_t end) {
+        fn(static_cast<int>(band), y0 + static_cast<int>(begin), static_cast<int>(end - begin));
+    });
+}
+
+// Merges into stats what scan(bandStats, run, length) gathers over parallel row bands. A scan
+// returns false once the answer is known, which stops every band; returns false in that case.
+template <typename Scan>
+bool reduceRowBands(const PixelStore& pixels, int x, int y, int width, int height, int bands, BlockStats& stats, Scan scan) {
+    std::vector<BlockStats> partial;
+    for (int i = 0; i < bands; i++) partial.emplace_back(stats.hist != nullptr);
+    std::atomic<bool> stopped(false);
+    forEachRowBand(pixels, y, height, bands, [&](int band, int bandY, int bandHeight) {
+        pixels.forEachRunWhile(x, bandY, width, bandHeight, [&](const RGB* run, int length) {
+            if (!scan(partial[band], run, length)) stopped = true;
+            return !stopped.load(std::memory_order_relaxed);
+        });
+    });
+    for (const BlockStats& band : partial) stats.merge(band);
+    return !stopped;
+}
+
+// Sum of |pixel - mean| over all channels of a run.
+inline long long absDeviation(const RGB* run, int length, RGB mean) {
+    if (length >= KERNEL_MIN_RUN) return pixelKernels().absDeviation(run, length, mean);
+    long long total = 0;
+    for (int k = 0; k < length; k++) {
+        total += std::abs(run[k].r - mean.r) + std::abs(run[k].g - mean.g) + std::abs(run[k].b - mean.b);
+    }
+    return total;
+}
+
+// Mean entropy of the three 256-bin channel histograms in hist.
+double entropyFromCounts(const uint32_t* hist, long long total);
+
+// Same as entropyFromCounts for n values per channel (R, then G, then B); may reorder values.
+double entropyFromValues(uint8_t* values, int n);
+
+// Mean SSIM between the block and a flat leaf of its average color, over 8x8 windows.
+double windowedSSIM(const IntegralImage& integral, int imageWidth, int imageHeight, int x, int y, int width, int height);
+
+// Defaults shared by all metrics; Metric is the derived policy.
+template <typename Metric>
+struct MetricBase {
+    static const bool MERGEABLE = true;    // error follows from merged BlockStats (fromStats)
+    static const bool HISTOGRAM = false;   // fromStats needs the histograms
+    static const bool SAMPLED = false;     // supported by sampled estimation
+    static const bool SAMPLED_RANGE = false;   // the sample's range, which can only underestimate
+    static const bool SAMPLED_SQUARED = false; // else the mean absolute deviation of the sample
+    static const bool USES_PYRAMID = false;    // subsetForcesSplit works on pyramid cells
+    static const bool USES_INTEGRAL = false;   // error reads the integral image
+    static const bool SMALL_BLOCKS = true; // provides smallExceeds<W> for blocks up to SMALL_BLOCK_MAX
+
+    static bool exceeds(double error, double threshold) { return error > threshold; }
+
+    // True when the statistics of a subset of the block's n pixels already prove a split.
+    static bool subsetForcesSplit(const BlockStats&, long long, double) { return false; }
+
+    // Same as exceeds(error(...)), but free to stop scanning once the answer is known.
+    static bool blockExceeds(const MetricInput& in, int x, int y, int width, int height, double threshold) {
+        return Metric::exceeds(Metric::error(in, x, y, width, height), threshold);
+    }
+
+    // Same as blockExceeds, with the scan shared by `bands` threads.
+    static bool bandsExceed(const MetricInput& in, int x, int y, int width, int height, double threshold, int) {
+        return Metric::blockExceeds(in, x, y, width, height, threshold);
+    }
+};
+
+// Scans a block with addMoments until subsetForcesSplit proves a split.
+template <typename Metric>
+bool momentsExceed(const MetricInput& in, int x, int y, int width, int height, double threshold) {
+    long long n = in.pixels.countInBlock(x, y, width, height);
+    if (n == 0) return Metric::exceeds(0.0, threshold);
+    BlockStats stats;
+    bool finished = in.pixels.forEachRunWhile(x, y, width, height, [&](const RGB* run, int length) {
+        stats.addMoments(run, length);
+        return stats.count == n || !Metric::subsetForcesSplit(stats, n, threshold);
+    });
+    return !finished || Metric::exceeds(Metric::fromStats(stats), threshold);
+}
+
+// Parallel form of momentsExceed; accumulate(stats, run, length) gathers what fromStats needs.
+template <typename Metric, typename Accumulate>
+bool statsBandsExceed(const MetricInput& in, int x, int y, int width, int height, double threshold, int bands, Accumulate accumulate) {
+    long long n = in.pixels.countInBlock(x, y, width, height);
+    if (n == 0) return Metric::exceeds(0.0, threshold);
+    BlockStats stats(Metric::HISTOGRAM);
+    bool finished = reduceRowBands(in.pixels, x, y, width, height, bands, stats, [&](BlockStats& band, const RGB* run, int length) {
+        accumulate(band, run, length);
+        return !Metric::subsetForcesSplit(band, n, threshold);
+    });
+    return !finished || Metric::exceeds(Metric::fromStats(stats), threshold);
+}
+
+inline void accumulateMoments(BlockStats& stats, const RGB* run, int length) { stats.addMoments(run, length); }
+inline void accumulateRange(BlockStats& stats, const RGB* run, int length) { stats.addRange(run, length); }
+inline void accumulateHistogram(BlockStats& stats, const RGB* run, int length) { stats.addHistogram(run, length); }
+
+// Exact decision for a small block from its unrolled moments.
+template <typename Metric, int W>
+bool smallMomentsExceed(const RGB* origin, int stride, int height, double threshold) {
+    BlockStats stats;
+    smallMoments<W>(origin, stride, height, stats);
+    return Metric::exceeds(Metric::fromStats(stats), threshold);
+}
+
+// Guards the floating-point lower bounds against rounding on exact ties.
+const double LOWER_BOUND_MARGIN = 1e-9;
+
+struct VarianceMetric : MetricBase<VarianceMetric> {
+    static const int METHOD = 1;
+    static const bool SAMPLED = true;
+    static const bool SAMPLED_SQUARED = true;
+    static const bool USES_PYRAMID = true;
+
+    static double fromStats(const BlockStats& stats) {
+        if (stats.count == 0) return 0.0;
+        RGB avg = stats.average();
+        const int mean[3] = {avg.r, avg.g, avg.b};
+        long long error = 0;
+        for (int ch = 0; ch < 3; ch++) {
+            error += stats.sumSq[ch] - 2LL * mean[ch] * stats.sum[ch] + stats.count * mean[ch] * mean[ch];
+        }
+        return error / (static_cast<double>(stats.count) * 3);
+    }
+
+    static double error(const MetricInput& in, int x, int y, int width, int height) {
+        BlockStats stats;
+        in.pixels.forEachRun(x, y, width, height, [&](const RGB* run, int length) {
+            stats.addMoments(run, length);
+        });
+        return fromStats(stats);
+    }
+
+    // The squared deviation of any subset around its own mean is a lower bound on the block's
+    // squared deviation around the block average.
+    static bool subsetForcesSplit(const BlockStats& subset, long long n, double threshold) {
+        if (subset.count == 0) return false;
+        double k = static_cast<double>(subset.count);
+        double ssd = 0;
+        for (int ch = 0; ch < 3; ch++) ssd += subset.sumSq[ch] - subset.sum[ch] * (subset.sum[ch] / k);
+        return ssd / (3.0 * n) - LOWER_BOUND_MARGIN > threshold;
+    }
+
+    static bool blockExceeds(const MetricInput& in, int x, int y, int width, int height, double threshold) {
+        return momentsExceed<VarianceMetric>(in, x, y, width, height, threshold);
+    }
+
+    static bool bandsExceed(const MetricInput& in, int x, int y, int width, int height, double threshold, int bands) {
+        return statsBandsExceed<VarianceMetric>(in, x, y, width, height, threshold, bands, accumulateMoments);
+    }
+
+    template <int W>
+    static bool smallExceeds(const RGB* origin, int stride, int height, double threshold) {
+        return smallMomentsExceed<VarianceMetric, W>(origin, stride, height, threshold);
+    }
+};
+
+struct MADMetric : MetricBase<MADMetric> {
+    static const int METHOD = 2;
+    static const bool HISTOGRAM = true;
+    static const bool SAMPLED = true;
+
+    static double fromStats(const BlockStats& stats) {
+        if (stats.count == 0) return 0.0;
+        RGB avg = stats.average();
+        const int mean[3] = {avg.r, avg.g, avg.b};
+        long long error = 0;
+        for (int ch = 0; ch < 3; ch++) {
+            for (int v = 0; v < 256; v++) error += static_cast<long long>((*stats.hist)[ch * 256 + v]) * std::abs(v - mean[ch]);
+        }
+        return error / (static_cast<double>(stats.count) * 3);
+    }
+
+    static double error(const MetricInput& in, int x, int y, int width, int height) {
+        RGB avg = blockAverage(in.pixels, x, y, width, height);
+        long long error = 0;
+        long long count = 0;
+        in.pixels.forEachRun(x, y, width, height, [&](const RGB* run, int length) {
+            error += absDeviation(run, length, avg);
+            count += length;
+        });
+        return count > 0 ? error / (count * 3.0) : 0;
+    }
+
+    // The absolute deviation only grows, so the scan stops once it passes threshold * 3n.
+    static bool blockExceeds(const MetricInput& in, int x, int y, int width, int height, double threshold) {
+        long long n = in.pixels.countInBlock(x, y, width, height);
+        if (n == 0) return exceeds(0.0, threshold);
+        RGB avg = blockAverage(in.pixels, x, y, width, height);
+        long long limit = static_cast<long long>(std::floor(threshold * 3.0 * n));
+        long long error = 0;
+        bool finished = in.pixels.forEachRunWhile(x, y, width, height, [&](const RGB* run, int length) {
+            error += absDeviation(run, length, avg);
+            return error <= limit;
+        });
+        return !finished || exceeds(error / (n * 3.0), threshold);
+    }
+
+    // Two parallel passes: the average from the moments, then the shared deviation total.
+    static bool bandsExceed(const MetricInput& in, int x, int y, int width, int height, double threshold, int bands) {
+        long long n = in.pixels.countInBlock(x, y, width, height);
+        if (n == 0) return exceeds(0.0, threshold);
+        BlockStats moments;
+        reduceRowBands(in.pixels, x, y, width, height, bands, moments, [](BlockStats& band, const RGB* run, int length) {
+            band.addMoments(run, length);
+            return true;
+        });
+        RGB avg = moments.average();
+        long long limit = static_cast<long long>(std::floor(threshold * 3.0 * n));
+        std::atomic<long long> error(0);
+        forEachRowBand(in.pixels, y, height, bands, [&](int, int bandY, int bandHeight) {
+            in.pixels.forEachRunWhile(x, bandY, width, bandHeight, [&](const RGB* run, int length) {
+                return (error += absDeviation(run, length, avg)) <= limit;
+            });
+        });
+        long long total = error;
+        return total > limit || exceeds(total / (n * 3.0), threshold);
+    }
+
+    template <int W>
+    static bool smallExceeds(const RGB* origin, int stride, int height, double threshold) {
+        BlockStats stats;
+        smallMoments<W>(origin, stride, height, stats);
+        long long error = smallAbsDeviation<W>(origin, stride, height, stats.average());
+        return exceeds(error / (stats.count * 3.0), threshold);
+    }
+};
+
+struct MaxDifferenceMetric : MetricBase<MaxDifferenceMetric> {
+    static const int METHOD = 3;
+    static const bool SAMPLED = true;
+    static const bool SAMPLED_RANGE = true;
+    static const bool USES_PYRAMID = true;
+
+    static double fromStats(const BlockStats& stats) {
+        if (stats.count == 0) return 0.0;
+        return ((stats.maxV[0] - stats.minV[0]) + (stats.maxV[1] - stats.minV[1]) + (stats.maxV[2] - stats.minV[2])) / 3.0;
+    }
+
+    static double error(const MetricInput& in, int x, int y, int width, int height) {
+        BlockStats stats;
+        in.pixels.forEachRun(x, y, width, height, [&](const RGB* run, int length) {
+            stats.addRange(run, length);
+        });
+        return fromStats(stats);
+    }
+
+    // A subset's min/max range can only grow.
+    static bool subsetForcesSplit(const BlockStats& subset, long long, double threshold) {
+        return subset.count > 0 && exceeds(fromStats(subset), threshold);
+    }
+
+    static bool blockExceeds(const MetricInput& in, int x, int y, int width, int height, double threshold) {
+        long long n = in.pixels.countInBlock(x, y, width, height);
+        if (n == 0) return exceeds(0.0, threshold);
+        BlockStats stats;
+        bool finished = in.pixels.forEachRunWhile(x, y, width, height, [&](const RGB* run, int length) {
+            stats.addRange(run, length);
+            return !subsetForcesSplit(stats, n, threshold);
+        });
+        return !finished || exceeds(fromStats(stats), threshold);
+    }
+
+    static bool bandsExceed(const MetricInput& in, int x, int y, int width, int height, double threshold, int bands) {
+        return statsBandsExceed<MaxDifferenceMetric>(in, x, y, width, height, threshold, bands, accumulateRange);
+    }
+
+    template <int W>
+    static bool smallExceeds(const RGB* origin, int stride, int height, double threshold) {
+        BlockStats stats;
+        smallRange<W>(origin, stride, height, stats);
+        return exceeds(fromStats(stats), threshold);
+    }
+};
+
+struct EntropyMetric : MetricBase<EntropyMetric> {
+    static const int METHOD = 4;
+    static const bool HISTOGRAM = true;
+
+    static double fromStats(const BlockStats& stats) {
+        return entropyFromCounts(stats.hist->data(), stats.count);
+    }
+
+    static double error(const MetricInput& in, int x, int y, int width, int height) {
+        // Four interleaved sub-histograms keep consecutive equal values from hitting the
+        // same counter back to back; small blocks use one to keep the clearing cheap.
+        uint32_t hist[4][3 * 256];
+        long long totalPixels = in.pixels.countInBlock(x, y, width, height);
+        int lanes = totalPixels >= 4096 ? 4 : 1;
+        std::fill(&hist[0][0], &hist[0][0] + lanes * 3 * 256, 0u);
+
+        in.pixels.forEachRun(x, y, width, height, [&](const RGB* run, int length) {
+            int k = 0;
+            if (lanes == 4) {
+                for (; k + 4 <= length; k += 4) {
+                    for (int lane = 0; lane < 4; lane++) {
+                        hist[lane][run[k + lane].r]++;
+                        hist[lane][256 + run[k + lane].g]++;
+                        hist[lane][512 + run[k + lane].b]++;
+                    }
+                }
+            }
+            for (; k < length; k++) {
+                hist[0][run[k].r]++;
+                hist[0][256 + run[k].g]++;
+                hist[0][512 + run[k].b]++;
+            }
+        });
+        for (int lane = 1; lane < lanes; lane++) {
+            for (int i = 0; i < 3 * 256; i++) hist[0][i] += hist[lane][i];
+        }
+        return entropyFromCounts(hist[0], totalPixels);
+    }
+
+    static bool bandsExceed(const MetricInput& in, int x, int y, int width, int height, double threshold, int bands) {
+        return statsBandsExceed<EntropyMetric>(in, x, y, width, height, threshold, bands, accumulateHistogram);
+    }
+
+    template <int W>
+    static bool smallExceeds(const RGB* origin, int stride, int height, double threshold) {
+        uint8_t values[3 * SMALL_BLOCK_MAX * SMALL_BLOCK_MAX];
+        smallChannels<W>(origin, stride, height, values);
+        return exceeds(entropyFromValues(values, W * height), threshold);
+    }
+};
+
+// Error is 1 - SSIM, and a block splits when its SSIM falls below the threshold.
+struct SSIMMetric : MetricBase<SSIMMetric> {
+    static const int METHOD = 5;
+    static const bool USES_PYRAMID = true;
+
+    static bool exceeds(double error, double threshold) { return 1.0 - error < threshold; }
+
+    static double fromStats(const BlockStats& stats) {
+        if (stats.count == 0) return 0.0;
+        const double C1 = (0.01 * 255.0) * (0.01 * 255.0);
+        const double C2 = (0.03 * 255.0) * (0.03 * 255.0);
+        RGB avg = stats.average();
+        const int mean[3] = {avg.r, avg.g, avg.b};
+        double n = static_cast<double>(stats.count);
+        double ssim = 0;
+        for (int ch = 0; ch < 3; ch++) {
+            double meanOrig = stats.sum[ch] / n;
+            double varOrig = stats.count > 1 ? (stats.sumSq[ch] - stats.sum[ch] * meanOrig) / (n - 1) : 0.0;
+            ssim += ((2.0 * meanOrig * mean[ch] + C1) * C2) /
+                    ((meanOrig * meanOrig + mean[ch] * mean[ch] + C1) * (varOrig + C2));
+        }
+        return 1.0 - std::max(-1.0, std::min(1.0, ssim / 3.0));
+    }
+
+    static double error(const MetricInput& in, int x, int y, int width, int height) {
+        BlockStats stats;
+        in.pixels.forEachRun(x, y, width, height, [&](const RGB* run, int length) {
+            stats.addMoments(run, length);
+        });
+        return fromStats(stats);
+    }
+
+    // SSIM of a flat leaf is at most C2 / (variance + C2) per channel.
+    static bool subsetForcesSplit(const BlockStats& subset, long long n, double threshold) {
+        if (subset.count == 0) return false;
+        const double C2 = (0.03 * 255.0) * (0.03 * 255.0);
+        double k = static_cast<double>(subset.count);
+        double ssimBound = 0;
+        for (int ch = 0; ch < 3; ch++) {
+            double ssd = subset.sumSq[ch] - subset.sum[ch] * (subset.sum[ch] / k);
+            ssimBound += C2 / (std::max(0.0, ssd) / std::max<long long>(1, n - 1) + C2);
+        }
+        return ssimBound / 3.0 + LOWER_BOUND_MARGIN < threshold;
+    }
+
+    static bool blockExceeds(const MetricInput& in, int x, int y, int width, int height, double threshold) {
+        return momentsExceed<SSIMMetric>(in, x, y, width, height, threshold);
+    }
+
+    static bool bandsExceed(const MetricInput& in, int x, int y, int width, int height, double threshold, int bands) {
+        return statsBandsExceed<SSIMMetric>(in, x, y, width, height, threshold, bands, accumulateMoments);
+    }
+
+    template <int W>
+    static bool smallExceeds(const RGB* origin, int stride, int height, double threshold) {
+        return smallMomentsExceed<SSIMMetric, W>(origin, stride, height, threshold);
+    }
+};
+
+// Not mergeable: every block is measured from the integral image instead.
+struct WindowedSSIMMetric : MetricBase<WindowedSSIMMetric> {
+    static const int METHOD = 6;
+    static const bool MERGEABLE = false;
+    static const bool USES_INTEGRAL = true;
+    static const bool SMALL_BLOCKS = false;
+
+    static bool exceeds(double error, double threshold) { return 1.0 - error < threshold; }
+
+    static double error(const MetricInput& in, int x, int y, int width, int height) {
+        return 1.0 - windowedSSIM(in.integral, in.pixels.getWidth(), in.pixels.getHeight(), x, y, width, height);
+    }
+};
+
+// Unknown methods never split.
+struct NullMetric : MetricBase<NullMetric> {
+    static const int METHOD = 0;
+    static const bool SMALL_BLOCKS = false;
+
+    static double fromStats(const BlockStats&) { return 0.0; }
+    static double error(const MetricInput&, int, int, int, int) { return 0.0; }
+};
+
+// The single runtime switch: calls fn with the policy of the given method.
+template <typename Fn>
+auto dispatchMetric(int method, Fn&& fn) {
+    switch (method) {
+        case 1: return fn(VarianceMetric());
+        case 2: return fn(MADMetric());
+        case 3: return fn(MaxDifferenceMetric());
+        case 4: return fn(EntropyMetric());
+        case 5: return fn(SSIMMetric());
+        case 6: return fn(WindowedSSIMMetric());
+        default: return fn(NullMetric());
+    }
+}
+
+#endif
@@ -0,0 +1,112 @@
+#include "GifFrameWriter.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include "CpuDispatch.hpp"
+#include "gif.h"
+
+using namespace std;
+
+struct GifFrameWriter::State {
+    GifWriter writer = {};
+};
+
+// Maps a source coordinate to the first canvas pixel whose center lies at or after it.
+static int toCanvasCoord(int coord, int sourceSize, int canvasSize) {
+    long long num = 2LL * coord * canvasSize - sourceSize;
+    long long den = 2LL * sourceSize;
+    long long result = num <= 0 ? 0 : (num + den - 1) / den;
+    return static_cast<int>(std::min<long long>(result, canvasSize));
+}
+
+GifFrameWriter::GifFrameWriter(int imgWidth, int imgHeight, const GifOptions& options)
+    : state(new State()), options(options), imgWidth(imgWidth), imgHeight(imgHeight), frameWidth(imgWidth), frameHeight(imgHeight) {
+    int longestSide = std::max(imgWidth, imgHeight);
+    if (options.maxDimension > 0 && longestSide > options.maxDimension) {
+        frameWidth = std::max(1, static_cast<int>(std::lround(static_cast<double>(imgWidth) * options.maxDimension / longestSide)));
+        frameHeight = std::max(1, static_cast<int>(std::lround(static_cast<double>(imgHeight) * options.maxDimension / longestSide)));
+    }
+    // The first and the last frame are always kept, so a cap below 2 is meaningless.
+    if (this->options.maxFrames > 0) this->options.maxFrames = std::max(this->options.maxFrames, 2);
+}
+
+GifFrameWriter::~GifFrameWriter() {
+    if (state->writer.f) GifEnd(&state->writer);
+}
+
+bool GifFrameWriter::begin(const std::string& filename, int delay, bool dither, int expectedLevels) {
+    gifDelay = std::max(1, delay / 10);
+    this->dither = dither;
+    this->expectedLevels = std::max(1, expectedLevels);
+
+    if (!GifBegin(&state->writer, filename.c_str(), frameWidth, frameHeight, gifDelay)) {
+        cerr << "Error: Gagal memulai pembuatan GIF ke " << filename << endl;
+        return false;
+    }
+
+    // Frames are rasterized straight into the RGBA buffer at the output size.
+    canvas.assign(static_cast<size_t>(frameWidth) * frameHeight * 4, 0);
+    for (size_t idx = 3; idx < canvas.size(); idx += 4) canvas[idx] = 255;
+
+    long long totalPixels = static_cast<long long>(frameWidth) * frameHeight;
+    minChanged = static_cast<long long>(std::ceil(options.minChangedFraction * totalPixels));
+    pendingChanged = 0;
+    pendingLevel = false;
+    framesWritten = 0;
+    return true;
+}
+
+void GifFrameWriter::drawNode(int x, int y, int width, int height, RGB color) {
+    int startX = toCanvasCoord(std::max(0, x), imgWidth, frameWidth);
+    int startY = toCanvasCoord(std::max(0, y), imgHeight, frameHeight);
+    int endX = toCanvasCoord(std::min(x + width, imgWidth), imgWidth, frameWidth);
+    int endY = toCanvasCoord(std::min(y + height, imgHeight), imgHeight, frameHeight);
+
+    if (startX >= endX) return;
+    const PixelKernels& kernels = pixelKernels();
+    for (int row = startY; row < endY; ++row) {
+        pendingChanged += kernels.paintRGBA(&canvas[(static_cast<size_t>(row) * frameWidth + startX) * 4], endX - startX, color);
+    }
+}
+
+bool GifFrameWriter::writeFrame() {
+    pendingChanged = 0;
+    pendingLevel = false;
+    framesWritten++;
+    return GifWriteFrame(&state->writer, canvas.data(), frameWidth, frameHeight, gifDelay, 8, dither);
+}
+
+bool GifFrameWriter::finishLevel(int level) {
+    pendingLevel = true;
+    if (framesWritten > 0) {
+        if (pendingChanged == 0 && options.skipUnchanged) return true;
+        if (pendingChanged < minChanged) return true;
+        if (options.maxFrames > 0) {
+            // Spread the intermediate frames evenly over the levels, keeping one slot for the final frame.
+            if (framesWritten >= options.maxFrames - 1) return true;
+            int targetLevel = static_cast<int>(std::ceil(static_cast<double>(framesWritten) * expectedLevels / (options.maxFrames - 1)));
+            if (level < targetLevel) return true;
+        }
+    }
+
+    if (!writeFrame()) {
+        cerr << "Error: Gagal membuat frame GIF level " << level << "." << endl;
+        return false;
+    }
+    return true;
+}
+
+bool GifFrameWriter::end() {
+    if (pendingLevel && (pendingChanged > 0 || !options.skipUnchanged)) {
+        if (!writeFrame()) {
+            cerr << "Error: Gagal membuat frame GIF terakhir." << endl;
+            GifEnd(&state->writer);
+            return false;
+        }
+    }
+    if (!GifEnd(&state->writer)) {
+        cerr << "Error: Gagal menyelesaikan pembuatan GIF." << endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef GIF_FRAME_WRITER_HPP
+#define GIF_FRAME_WRITER_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Image.hpp"
+
+struct GifOptions {
+    int maxFrames = 0;               // 0 = no limit
+    double minChangedFraction = 0.0; // merge levels until this fraction of pixels has changed
+    bool skipUnchanged = false;      // drop levels that change no visible pixel
+    int maxDimension = 0;            // longest frame side in pixels, 0 = source resolution
+};
+
+// Accumulates quadtree levels onto an RGBA canvas and decides which of them become GIF frames.
+class GifFrameWriter {
+private:
+    struct State;
+    std::unique_ptr<State> state;
+    GifOptions options;
+    int imgWidth, imgHeight;
+    int frameWidth, frameHeight;
+    int gifDelay = 1;
+    bool dither = false;
+    int expectedLevels = 0;
+    std::vector<uint8_t> canvas;
+    long long minChanged = 0;
+    long long pendingChanged = 0;
+    bool pendingLevel = false;
+    int framesWritten = 0;
+
+    bool writeFrame();
+
+public:
+    GifFrameWriter(int imgWidth, int imgHeight, const GifOptions& options);
+    ~GifFrameWriter();
+
+    bool begin(const std::string& filename, int delay, bool dither, int expectedLevels);
+    void drawNode(int x, int y, int width, int height, RGB color);
+    bool finishLevel(int level);
+    bool end();
+
+    int getFramesWritten() const { return framesWritten; }
+};
+
+#endif
@@ -33,7 +33,7 @@ public:
         unsigned char* data = stbi_load(filename.c_str(), &width, &height, &channels, 3);
         if (!data) return false;
 
-        pixels.resize(height, std::vector<RGB>(width));
+        pixels.assign(height, std::vector<RGB>(width));
         for (int y = 0; y < height; y++) {
             for (int x = 0; x < width; x++) {
                 int idx = (y * width + x) * 3;
@@ -0,0 +1,114 @@
+#include "ImagePyramid.hpp"
+#include <algorithm>
+
+void ImagePyramid::computeCell(const PixelStore& pixels, Level& base, int cx, int cy) {
+    int cellSize = 1 << BASE_LEVEL;
+    BlockStats stats;
+    pixels.forEachRun(cx * cellSize, cy * cellSize, cellSize, cellSize, [&](const RGB* run, int length) {
+        stats.addMoments(run, length);
+        stats.addRange(run, length);
+    });
+    Cell& cell = base.cells[static_cast<size_t>(cy) * base.cellsX + cx];
+    for (int ch = 0; ch < 3; ch++) {
+        cell.sum[ch] = stats.sum[ch];
+        cell.sumSq[ch] = stats.sumSq[ch];
+        cell.minV[ch] = stats.minV[ch];
+        cell.maxV[ch] = stats.maxV[ch];
+    }
+}
+
+void ImagePyramid::combineCell(const Level& fine, Level& coarse, int cx, int cy) {
+    Cell& cell = coarse.cells[static_cast<size_t>(cy) * coarse.cellsX + cx];
+    cell = fine.cells[static_cast<size_t>(2 * cy) * fine.cellsX + 2 * cx];
+    for (int k = 1; k < 4; k++) {
+        const Cell& part = fine.cells[static_cast<size_t>(2 * cy + (k >> 1)) * fine.cellsX + 2 * cx + (k & 1)];
+        for (int ch = 0; ch < 3; ch++) {
+            cell.sum[ch] += part.sum[ch];
+            cell.sumSq[ch] += part.sumSq[ch];
+            cell.minV[ch] = std::min(cell.minV[ch], part.minV[ch]);
+            cell.maxV[ch] = std::max(cell.maxV[ch], part.maxV[ch]);
+        }
+    }
+}
+
+void ImagePyramid::build(const PixelStore& pixels) {
+    levels.clear();
+    int cellSize = 1 << BASE_LEVEL;
+    Level base;
+    base.cellsX = pixels.getWidth() / cellSize;
+    base.cellsY = pixels.getHeight() / cellSize;
+    if (base.cellsX == 0 || base.cellsY == 0) return;
+
+    base.cells.resize(static_cast<size_t>(base.cellsX) * base.cellsY);
+    for (int cy = 0; cy < base.cellsY; cy++) {
+        for (int cx = 0; cx < base.cellsX; cx++) computeCell(pixels, base, cx, cy);
+    }
+    levels.push_back(std::move(base));
+
+    while (levels.back().cellsX >= 2 && levels.back().cellsY >= 2) {
+        const Level& fine = levels.back();
+        Level coarse;
+        coarse.cellsX = fine.cellsX / 2;
+        coarse.cellsY = fine.cellsY / 2;
+        coarse.cells.resize(static_cast<size_t>(coarse.cellsX) * coarse.cellsY);
+        for (int cy = 0; cy < coarse.cellsY; cy++) {
+            for (int cx = 0; cx < coarse.cellsX; cx++) combineCell(fine, coarse, cx, cy);
+        }
+        levels.push_back(std::move(coarse));
+    }
+}
+
+void ImagePyramid::update(const PixelStore& pixels, int x, int y, int width, int height) {
+    int x0 = std::max(0, x), y0 = std::max(0, y);
+    int x1 = x + width, y1 = y + height;
+    for (size_t i = 0; i < levels.size(); i++) {
+        Level& level = levels[i];
+        int shift = BASE_LEVEL + static_cast<int>(i);
+        int cx1 = std::min(level.cellsX, ((x1 - 1) >> shift) + 1);
+        int cy1 = std::min(level.cellsY, ((y1 - 1) >> shift) + 1);
+        for (int cy = y0 >> shift; cy < cy1; cy++) {
+            for (int cx = x0 >> shift; cx < cx1; cx++) {
+                if (i == 0) {
+                    computeCell(pixels, level, cx, cy);
+                } else {
+                    combineCell(levels[i - 1], level, cx, cy);
+                }
+            }
+        }
+    }
+}
+
+bool ImagePyramid::innerStats(int x, int y, int width, int height, BlockStats& stats) const {
+    // Coarsest first: the first level that fits is the cheapest one to read.
+    int side = std::min(width, height);
+    int index = -1;
+    for (int i = static_cast<int>(levels.size()) - 1; i >= 0; i--) {
+        if ((CELLS_PER_SIDE << (BASE_LEVEL + i)) <= side) {
+            index = i;
+            break;
+        }
+    }
+    if (index < 0) return false;
+
+    const Level& level = levels[index];
+    int shift = BASE_LEVEL + index;
+    int cellSize = 1 << shift;
+    int cx0 = (x + cellSize - 1) >> shift, cy0 = (y + cellSize - 1) >> shift;
+    int cx1 = std::min((x + width) >> shift, level.cellsX);
+    int cy1 = std::min((y + height) >> shift, level.cellsY);
+    if (cx0 >= cx1 || cy0 >= cy1) return false;
+
+    for (int cy = cy0; cy < cy1; cy++) {
+        for (int cx = cx0; cx < cx1; cx++) {
+            const Cell& cell = level.cells[static_cast<size_t>(cy) * level.cellsX + cx];
+            for (int ch = 0; ch < 3; ch++) {
+                stats.sum[ch] += cell.sum[ch];
+                stats.sumSq[ch] += cell.sumSq[ch];
+                stats.minV[ch] = std::min(stats.minV[ch], cell.minV[ch]);
+                stats.maxV[ch] = std::max(stats.maxV[ch], cell.maxV[ch]);
+            }
+        }
+    }
+    stats.count += static_cast<long long>(cx1 - cx0) * (cy1 - cy0) * cellSize * cellSize;
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef IMAGE_PYRAMID_HPP
+#define IMAGE_PYRAMID_HPP
+
+#include <cstdint>
+#include <vector>
+#include "BlockStats.hpp"
+#include "PixelStore.hpp"
+
+// Mean/variance mipmap chain: level L holds the sums, sums of squares and min/max of
+// aligned 2^L x 2^L cells, from 8x8 cells upwards.
+class ImagePyramid {
+public:
+    static const int BASE_LEVEL = 3;
+    static const int CELLS_PER_SIDE = 8;   // minimum number of whole cells across a queried block
+
+private:
+    struct Cell {
+        long long sum[3];
+        long long sumSq[3];
+        uint8_t minV[3];
+        uint8_t maxV[3];
+    };
+
+    struct Level {
+        int cellsX = 0;
+        int cellsY = 0;            // whole cells only; border remainders are never used
+        std::vector<Cell> cells;
+    };
+
+    std::vector<Level> levels;     // levels[i] has cell size 2^(BASE_LEVEL + i)
+
+    static void computeCell(const PixelStore& pixels, Level& base, int cx, int cy);
+    static void combineCell(const Level& fine, Level& coarse, int cx, int cy);
+
+public:
+    void build(const PixelStore& pixels);
+    void clear() { levels.clear(); }
+    bool empty() const { return levels.empty(); }
+    // Recomputes the cells overlapping a changed block of pixels.
+    void update(const PixelStore& pixels, int x, int y, int width, int height);
+
+    // Statistics of the whole cells inside the block, taken from the coarsest level that
+    // still has at least CELLS_PER_SIDE cells across the block's shorter side, so at most a
+    // few hundred cells are read. Returns false if the block is too small for any level.
+    bool innerStats(int x, int y, int width, int height, BlockStats& stats) const;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef INTEGRAL_IMAGE_HPP
+#define INTEGRAL_IMAGE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "PixelStore.hpp"
+
+// Summed-area tables of every channel and its square, so that the sum of x and x^2 over
+// any rectangle costs four lookups per strip. The tables restart every STRIP_ROWS rows and
+// hold 32-bit sums that wrap around: the difference of four entries is still exact as long
+// as the true sum of the rectangle fits in 32 bits, which holds for squares over the SSIM
+// windows and for plain sums over a strip up to 263168 pixels wide.
+class IntegralImage {
+public:
+    static const int STRIP_SHIFT = 6;
+    static const int STRIP_ROWS = 1 << STRIP_SHIFT;
+
+private:
+    int width = 0;
+    int height = 0;
+    int stride = 0;                      // width + 1
+    std::vector<uint32_t> sum[3];
+    std::vector<uint32_t> sumSq[3];
+
+public:
+    void build(const PixelStore& pixels) {
+        width = pixels.getWidth();
+        height = pixels.getHeight();
+        stride = width + 1;
+        // Every strip has a zero row above its first pixel row.
+        int strips = (height + STRIP_ROWS - 1) >> STRIP_SHIFT;
+        for (int ch = 0; ch < 3; ch++) {
+            sum[ch].assign(static_cast<size_t>(stride) * (height + strips), 0);
+            sumSq[ch].assign(static_cast<size_t>(stride) * (height + strips), 0);
+        }
+        update(pixels, 0, 0, width, height);
+    }
+
+    // Refreshes the entries after a change to [x, x + w) x [y, y + h): entries left of the
+    // block and strips above or below it keep their values.
+    void update(const PixelStore& pixels, int x, int y, int w, int h) {
+        if (w <= 0 || h <= 0) return;
+        int end = std::min(height, ((y + h - 1) | (STRIP_ROWS - 1)) + 1);
+        for (int row = y; row < end; row++) {
+            size_t above = rowAbove(row);
+            size_t here = above + stride;
+            uint32_t rowSum[3], rowSumSq[3];
+            for (int ch = 0; ch < 3; ch++) {
+                rowSum[ch] = sum[ch][here + x] - sum[ch][above + x];
+                rowSumSq[ch] = sumSq[ch][here + x] - sumSq[ch][above + x];
+            }
+            for (int col = x; col < width; col++) {
+                const RGB& p = pixels.at(col, row);
+                const uint32_t c[3] = {p.r, p.g, p.b};
+                for (int ch = 0; ch < 3; ch++) {
+                    rowSum[ch] += c[ch];
+                    rowSumSq[ch] += c[ch] * c[ch];
+                    sum[ch][here + col + 1] = sum[ch][above + col + 1] + rowSum[ch];
+                    sumSq[ch][here + col + 1] = sumSq[ch][above + col + 1] + rowSumSq[ch];
+                }
+            }
+        }
+    }
+
+    void clear() {
+        for (int ch = 0; ch < 3; ch++) {
+            sum[ch].clear();
+            sumSq[ch].clear();
+        }
+    }
+
+    bool empty() const { return sum[0].empty(); }
+    int getStride() const { return stride; }
+    const uint32_t* sums(int channel) const { return sum[channel].data(); }
+    const uint32_t* sumsOfSquares(int channel) const { return sumSq[channel].data(); }
+
+    // Offset of the table row just above pixel row y, within y's strip.
+    size_t rowAbove(int y) const {
+        return (static_cast<size_t>(y >> STRIP_SHIFT) * (STRIP_ROWS + 1) + (y & (STRIP_ROWS - 1))) * stride;
+    }
+
+    // Calls fn(top, bottom) with the table row offsets that bound pixel rows [y0, y1) in each strip.
+    template <typename Fn>
+    void forEachStrip(int y0, int y1, Fn fn) const {
+        while (y0 < y1) {
+            int end = std::min(y1, ((y0 >> STRIP_SHIFT) + 1) << STRIP_SHIFT);
+            fn(rowAbove(y0), rowAbove(end - 1) + stride);
+            y0 = end;
+        }
+    }
+
+    // Four-entry difference between table rows top and bottom over columns [x0, x1).
+    static uint32_t box(const uint32_t* table, size_t top, size_t bottom, int x0, int x1) {
+        return table[bottom + x1] - table[top + x1] - table[bottom + x0] + table[top + x0];
+    }
+
+    // Sum of a channel over [x0, x1) x [y0, y1).
+    long long rectSum(int channel, int x0, int y0, int x1, int y1) const {
+        long long total = 0;
+        forEachStrip(y0, y1, [&](size_t top, size_t bottom) {
+            total += box(sum[channel].data(), top, bottom, x0, x1);
+        });
+        return total;
+    }
+};
+
+#endif
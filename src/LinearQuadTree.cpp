@@ -0,0 +1,84 @@
+#include "LinearQuadTree.hpp"
+#include <algorithm>
+
+uint8_t LinearQuadTree::splitAt(uint64_t path, int level) const {
+    if (splitKeys.empty()) return 0;
+    uint64_t key = makeKey(path, level);
+    auto it = std::lower_bound(splitKeys.begin(), splitKeys.end(), key);
+    return it != splitKeys.end() && *it == key ? splits[it - splitKeys.begin()] : 0;
+}
+
+Rect LinearQuadTree::getRect(size_t leaf) const {
+    Rect rect = {0, 0, width, height};
+    int level = getLevel(leaf);
+    for (int l = 0; l < level; ++l) {
+        uint64_t path = l == 0 ? 0 : keys[leaf] >> (64 - 2 * l);
+        rect = childRect(rect, static_cast<int>((keys[leaf] >> (62 - 2 * l)) & 3), splitAt(path, l));
+    }
+    return rect;
+}
+
+// Keys of child c of the node (path, level), within the node's key range [first, last).
+void LinearQuadTree::childRange(uint64_t path, int level, int c, size_t first, size_t last, size_t& childFirst, size_t& childLast) const {
+    const uint64_t levelMask = (1u << LEVEL_BITS) - 1;
+    uint64_t childPath = (path << 2) | c;
+    uint64_t begin = makeKey(childPath, level + 1) & ~levelMask;
+    childFirst = std::lower_bound(keys.begin() + first, keys.begin() + last, begin) - keys.begin();
+    childLast = last;
+    if (c < 3) {
+        uint64_t end = makeKey(childPath + 1, level + 1) & ~levelMask;
+        childLast = std::lower_bound(keys.begin() + childFirst, keys.begin() + last, end) - keys.begin();
+    }
+}
+
+size_t LinearQuadTree::findLeaf(int x, int y) const {
+    // Descends while the node has leaves below it; a node whose range is its own key is the leaf.
+    Rect rect = {0, 0, width, height};
+    uint64_t path = 0;
+    size_t first = 0, last = keys.size();
+    for (int level = 0; last - first > 1 || getLevel(first) != level; level++) {
+        uint8_t split = splitAt(path, level);
+        Rect nw = childRect(rect, 0, split);
+        int quadrant = (y >= rect.y + nw.height ? 2 : 0) | (x >= rect.x + nw.width ? 1 : 0);
+        childRange(path, level, quadrant, first, last, first, last);
+        rect = childRect(rect, quadrant, split);
+        path = (path << 2) | quadrant;
+    }
+    return first;
+}
+
+RGB LinearQuadTree::colorAt(int x, int y) const {
+    if (keys.empty() || x < 0 || y < 0 || x >= width || y >= height) return RGB();
+    return colors[findLeaf(x, y)];
+}
+
+void LinearQuadTree::collectLeaves(const Rect& rect, uint64_t path, int level, size_t first, size_t last, const Rect& query, std::vector<size_t>& result) const {
+    if (first >= last || !overlaps(rect, query)) return;
+    if (last - first == 1 && getLevel(first) == level) {
+        result.push_back(first);
+        return;
+    }
+    uint8_t split = splitAt(path, level);
+    for (int c = 0; c < 4; ++c) {
+        size_t childFirst, childLast;
+        childRange(path, level, c, first, last, childFirst, childLast);
+        collectLeaves(childRect(rect, c, split), (path << 2) | c, level + 1, childFirst, childLast, query, result);
+    }
+}
+
+std::vector<size_t> LinearQuadTree::leavesInRect(const Rect& query) const {
+    std::vector<size_t> result;
+    collectLeaves({0, 0, width, height}, 0, 0, 0, keys.size(), query, result);
+    return result;
+}
+
+std::vector<std::vector<RGB>> LinearQuadTree::reconstructImage() const {
+    std::vector<std::vector<RGB>> result(height, std::vector<RGB>(width));
+    for (size_t leaf = 0; leaf < keys.size(); ++leaf) {
+        Rect rect = getRect(leaf);
+        for (int y = rect.y; y < rect.y + rect.height; y++) {
+            std::fill(result[y].begin() + rect.x, result[y].begin() + rect.x + rect.width, colors[leaf]);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,63 @@
+#ifndef LINEAR_QUADTREE_HPP
+#define LINEAR_QUADTREE_HPP
+
+#include <cstdint>
+#include <vector>
+#include "QuadNode.hpp"
+
+// Leaves-only quadtree: one sorted key per leaf, no internal nodes.
+// A key holds the quadrant path (2 bits per level, NW=0 NE=1 SW=2 SE=3) left-aligned
+// in the high bits and the level in the low bits, so sorting by key gives Z-order.
+class LinearQuadTree {
+public:
+    static const int MAX_LEVEL = 29;
+
+private:
+    static const int LEVEL_BITS = 6;
+
+    int width = 0;
+    int height = 0;
+    std::vector<uint64_t> keys;
+    std::vector<RGB> colors;
+    std::vector<uint64_t> splitKeys;   // internal nodes with split bits set (QuadNode.hpp), sorted
+    std::vector<uint8_t> splits;
+
+    uint8_t splitAt(uint64_t path, int level) const;
+    void childRange(uint64_t path, int level, int c, size_t first, size_t last, size_t& childFirst, size_t& childLast) const;
+    size_t findLeaf(int x, int y) const;
+    void collectLeaves(const Rect& rect, uint64_t path, int level, size_t first, size_t last, const Rect& query, std::vector<size_t>& result) const;
+
+public:
+    LinearQuadTree() = default;
+    LinearQuadTree(int width, int height) : width(width), height(height) {}
+
+    static uint64_t makeKey(uint64_t path, int level) {
+        return level == 0 ? 0 : (path << (64 - 2 * level)) | static_cast<uint64_t>(level);
+    }
+
+    // Leaves must be added in Z-order.
+    void addLeaf(uint64_t path, int level, RGB color) {
+        keys.push_back(makeKey(path, level));
+        colors.push_back(color);
+    }
+
+    // Only for internal nodes whose split bits are set, also in Z-order. Trees built by
+    // compress have none; flipped and rotated ones do.
+    void addSplit(uint64_t path, int level, uint8_t split) {
+        splitKeys.push_back(makeKey(path, level));
+        splits.push_back(split);
+    }
+
+    size_t size() const { return keys.size(); }
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getLevel(size_t leaf) const { return static_cast<int>(keys[leaf] & ((1u << LEVEL_BITS) - 1)); }
+    RGB getColor(size_t leaf) const { return colors[leaf]; }
+    Rect getRect(size_t leaf) const;
+
+    RGB colorAt(int x, int y) const;
+    std::vector<size_t> leavesInRect(const Rect& query) const;
+    std::vector<std::vector<RGB>> reconstructImage() const;
+};
+
+#endif
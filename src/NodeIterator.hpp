@@ -0,0 +1,230 @@
+#ifndef NODE_ITERATOR_HPP
+#define NODE_ITERATOR_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+#include "QuadNode.hpp"
+
+// Every level halves both sides of a block, so an int-sized image has at most this many levels.
+const int MAX_TREE_DEPTH = 32;
+
+// A node together with what the walk recovers on the way down.
+struct NodeRef {
+    const QuadNode* node;
+    uint32_t index;   // position in the breadth-first node array
+    int level;
+    uint64_t path;    // two bits per level (quadrant 0-3), the root's child in the highest bits
+    Rect rect;
+};
+
+inline NodeRef childRef(const QuadNode* nodes, const NodeRef& parent, int c) {
+    uint32_t index = parent.node->firstChild + c;
+    return {&nodes[index], index, parent.level + 1, (parent.path << 2) | static_cast<uint64_t>(c), childRect(parent.rect, c, parent.node->split)};
+}
+
+// Pre-order walk over a breadth-first node array, with a fixed stack of one frame per level.
+// A default-constructed cursor is the end.
+class NodeCursor {
+public:
+    enum Filter {
+        All,            // every node
+        Leaves          // leaves only
+    };
+
+    NodeCursor() = default;
+
+    NodeCursor(const QuadNode* nodes, size_t count, const Rect& root, Filter filter)
+        : nodes(nodes), filter(filter) {
+        if (count == 0) return;
+        top = 0;
+        frames[0] = {{&nodes[0], 0, 0, 0, root}, 0};
+        if (!accepts(frames[0].ref)) advance();
+    }
+
+    const NodeRef& operator*() const { return frames[top].ref; }
+    const NodeRef* operator->() const { return &frames[top].ref; }
+
+    NodeCursor& operator++() {
+        advance();
+        return *this;
+    }
+
+    bool operator==(const NodeCursor& other) const {
+        if (top < 0 || other.top < 0) return top < 0 && other.top < 0;
+        return frames[top].ref.index == other.frames[other.top].ref.index;
+    }
+    bool operator!=(const NodeCursor& other) const { return !(*this == other); }
+
+private:
+    struct Frame {
+        NodeRef ref;
+        int nextChild;
+    };
+
+    const QuadNode* nodes = nullptr;
+    Filter filter = All;
+    int top = -1;
+    Frame frames[MAX_TREE_DEPTH];
+
+    bool accepts(const NodeRef& ref) const {
+        return filter == All || ref.node->isLeaf();
+    }
+
+    void advance() {
+        while (top >= 0) {
+            Frame& frame = frames[top];
+            if (frame.ref.node->isLeaf() || frame.ref.level + 1 == MAX_TREE_DEPTH || frame.nextChild == 4) {
+                top--;
+                continue;
+            }
+            frames[top + 1] = {childRef(nodes, frame.ref, frame.nextChild++), 0};
+            top++;
+            if (accepts(frames[top].ref)) return;
+        }
+    }
+};
+
+// Level-order walk over levels [firstLevel, lastLevel] of a breadth-first node array, one
+// range [levelOffsets[d], levelOffsets[d + 1]) after the other. Children are stored in the
+// order of their parents, so the rectangles and paths of the next level are appended while
+// the current one is walked; only two levels of them are kept. Levels above firstLevel are
+// walked without being reported. A default-constructed cursor is the end.
+class LevelCursor {
+public:
+    LevelCursor() = default;
+
+    LevelCursor(const QuadNode* nodes, const int* levelOffsets, int levels, const Rect& root, int firstLevel, int lastLevel)
+        : nodes(nodes), levelOffsets(levelOffsets), lastLevel(std::min(lastLevel, levels - 1)) {
+        if (firstLevel < 0 || firstLevel > this->lastLevel) return;
+        rects.push_back(root);
+        paths.push_back(0);
+        for (; level < firstLevel; level++) {
+            for (int i = levelOffsets[level]; i < levelOffsets[level + 1]; i++) addChildren(i);
+            nextLevel();
+        }
+        index = levelOffsets[level];
+        load();
+    }
+
+    const NodeRef& operator*() const { return ref; }
+    const NodeRef* operator->() const { return &ref; }
+
+    LevelCursor& operator++() {
+        if (level < lastLevel) addChildren(index);
+        if (++index == levelOffsets[level + 1]) {
+            if (++level > lastLevel) {
+                index = -1;
+                return *this;
+            }
+            nextLevel();
+        }
+        load();
+        return *this;
+    }
+
+    bool operator==(const LevelCursor& other) const { return index == other.index; }
+    bool operator!=(const LevelCursor& other) const { return !(*this == other); }
+
+private:
+    const QuadNode* nodes = nullptr;
+    const int* levelOffsets = nullptr;
+    int lastLevel = -1;
+    int level = 0;
+    int index = -1;
+    NodeRef ref = {};
+    std::vector<Rect> rects, nextRects;     // of the current and the next level
+    std::vector<uint64_t> paths, nextPaths;
+
+    void addChildren(int i) {
+        if (nodes[i].isLeaf()) return;
+        int k = i - levelOffsets[level];
+        for (int c = 0; c < 4; c++) {
+            nextRects.push_back(childRect(rects[k], c, nodes[i].split));
+            nextPaths.push_back((paths[k] << 2) | static_cast<uint64_t>(c));
+        }
+    }
+
+    void nextLevel() {
+        rects.swap(nextRects);
+        paths.swap(nextPaths);
+        nextRects.clear();
+        nextPaths.clear();
+    }
+
+    void load() {
+        int k = index - levelOffsets[level];
+        ref = {&nodes[index], static_cast<uint32_t>(index), level, paths[k], rects[k]};
+    }
+};
+
+class NodeRange {
+public:
+    explicit NodeRange(const NodeCursor& first) : first(first) {}
+    NodeCursor begin() const { return first; }
+    NodeCursor end() const { return NodeCursor(); }
+
+private:
+    NodeCursor first;
+};
+
+// The level buffers are only allocated once iteration begins.
+class LevelRange {
+public:
+    LevelRange(const QuadNode* nodes, const std::vector<int>& levelOffsets, const Rect& root, int firstLevel, int lastLevel)
+        : nodes(nodes), levelOffsets(levelOffsets), root(root), firstLevel(firstLevel), lastLevel(lastLevel) {}
+    LevelCursor begin() const {
+        int levels = levelOffsets.empty() ? 0 : static_cast<int>(levelOffsets.size()) - 1;
+        return LevelCursor(nodes, levelOffsets.data(), levels, root, firstLevel, lastLevel);
+    }
+    LevelCursor end() const { return LevelCursor(); }
+
+private:
+    const QuadNode* nodes;
+    const std::vector<int>& levelOffsets;
+    Rect root;
+    int firstLevel, lastLevel;
+};
+
+template <typename Fn>
+bool visitNode(Fn& fn, const NodeRef& ref) {
+    if constexpr (std::is_void_v<decltype(fn(ref))>) {
+        fn(ref);
+        return true;
+    } else {
+        return fn(ref);
+    }
+}
+
+// Pre-order visit of the subtree under root with an explicit stack. fn(const NodeRef&) may
+// return false to skip the node's children.
+template <typename Fn>
+void visitSubtree(const QuadNode* nodes, const NodeRef& root, Fn fn) {
+    struct Frame {
+        NodeRef ref;
+        int nextChild;
+    };
+    Frame frames[MAX_TREE_DEPTH];
+    int top = 0;
+    frames[0] = {root, 0};
+    if (!visitNode(fn, frames[0].ref)) return;
+    while (top >= 0) {
+        Frame& frame = frames[top];
+        if (frame.ref.node->isLeaf() || frame.nextChild == 4 || frame.ref.level + 1 == MAX_TREE_DEPTH) {
+            top--;
+            continue;
+        }
+        Frame& child = frames[++top];
+        child = {childRef(nodes, frame.ref, frame.nextChild++), 0};
+        if (!visitNode(fn, child.ref)) child.nextChild = 4;
+    }
+}
+
+template <typename Fn>
+void visitNodes(const QuadNode* nodes, size_t count, const Rect& root, Fn fn) {
+    if (count > 0) visitSubtree(nodes, {&nodes[0], 0, 0, 0, root}, fn);
+}
+
+#endif
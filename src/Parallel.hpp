@@ -0,0 +1,66 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// A block is only split into row bands when every band gets at least this many pixels,
+// so the thread start-up stays small next to the scan.
+const long long PARALLEL_BAND_MIN = 1 << 16;
+
+// Asked once: hardware_concurrency reads the CPU affinity on every call.
+inline size_t hardwareThreads() {
+    static const size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    return threads;
+}
+
+// True on a thread that runs a slice of parallelChunks, where every core is already busy.
+inline bool& insideParallelSlice() {
+    thread_local bool inside = false;
+    return inside;
+}
+
+// Number of row bands for a block of the given pixel count; 1 means scan it serially, which
+// is always the case inside a parallel slice so that nested scans do not start more threads.
+inline int bandCount(long long blockPixels) {
+    if (blockPixels < 2 * PARALLEL_BAND_MIN || insideParallelSlice()) return 1;
+    return static_cast<int>(std::max<long long>(1, std::min<long long>(hardwareThreads(), blockPixels / PARALLEL_BAND_MIN)));
+}
+
+// Calls fn(chunk, begin, end) for `chunks` balanced slices of [0, count), each on its own
+// thread; the last slice runs on the calling thread.
+template <typename Fn>
+void parallelChunks(size_t count, size_t chunks, Fn fn) {
+    chunks = std::max<size_t>(1, std::min(chunks, count));
+    std::vector<std::thread> workers;
+    for (size_t chunk = 0; chunk + 1 < chunks; ++chunk) {
+        size_t begin = count * chunk / chunks;
+        size_t end = count * (chunk + 1) / chunks;
+        workers.emplace_back([&fn, chunk, begin, end]() {
+            insideParallelSlice() = true;
+            fn(chunk, begin, end);
+        });
+    }
+    bool wasInside = insideParallelSlice();
+    insideParallelSlice() = true;
+    fn(chunks - 1, count * (chunks - 1) / chunks, count);
+    insideParallelSlice() = wasInside;
+    for (auto& worker : workers) worker.join();
+}
+
+// Calls fn(i) for every i in [0, count), spread over the cores once there is enough work.
+template <typename Fn>
+void parallelFor(size_t count, Fn fn) {
+    size_t threads = std::min(hardwareThreads(), count / 64);
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+    parallelChunks(count, threads, [&fn](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) fn(i);
+    });
+}
+
+#endif
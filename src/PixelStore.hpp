@@ -0,0 +1,138 @@
+#ifndef PIXEL_STORE_HPP
+#define PIXEL_STORE_HPP
+
+#include <algorithm>
+#include <vector>
+#include "Image.hpp"
+
+enum class PixelLayout {
+    RowMajor,   // one contiguous buffer, row after row
+    Tiled       // 8x8 tiles, each tile contiguous
+};
+
+// Flat working copy of the image used by the error kernels.
+class PixelStore {
+public:
+    static const int TILE_SHIFT = 3;
+    static const int TILE_SIZE = 1 << TILE_SHIFT;
+
+private:
+    std::vector<RGB> data;
+    int width = 0;
+    int height = 0;
+    int tilesX = 0;
+    PixelLayout layout = PixelLayout::RowMajor;
+
+    size_t tiledIndex(int x, int y) const {
+        size_t tile = static_cast<size_t>(y >> TILE_SHIFT) * tilesX + (x >> TILE_SHIFT);
+        return (tile << (2 * TILE_SHIFT)) + ((y & (TILE_SIZE - 1)) << TILE_SHIFT) + (x & (TILE_SIZE - 1));
+    }
+
+public:
+    void load(const std::vector<std::vector<RGB>>& pixels, PixelLayout newLayout) {
+        layout = newLayout;
+        height = pixels.size();
+        width = height > 0 ? static_cast<int>(pixels[0].size()) : 0;
+        tilesX = (width + TILE_SIZE - 1) >> TILE_SHIFT;
+        int tilesY = (height + TILE_SIZE - 1) >> TILE_SHIFT;
+
+        if (layout == PixelLayout::RowMajor) {
+            data.resize(static_cast<size_t>(width) * height);
+            for (int y = 0; y < height; y++) {
+                std::copy(pixels[y].begin(), pixels[y].end(), data.begin() + static_cast<size_t>(y) * width);
+            }
+        } else {
+            data.assign(static_cast<size_t>(tilesX) * tilesY * TILE_SIZE * TILE_SIZE, RGB());
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    data[tiledIndex(x, y)] = pixels[y][x];
+                }
+            }
+        }
+    }
+
+    // Copies the block of pixels (same size as the loaded image) clipped to the image.
+    void update(const std::vector<std::vector<RGB>>& pixels, int x, int y, int w, int h) {
+        int x0 = std::max(0, x), y0 = std::max(0, y);
+        int x1 = std::min(width, x + w), y1 = std::min(height, y + h);
+        for (int row = y0; row < y1; row++) {
+            for (int col = x0; col < x1; col++) {
+                data[layout == PixelLayout::RowMajor ? static_cast<size_t>(row) * width + col : tiledIndex(col, row)] = pixels[row][col];
+            }
+        }
+    }
+
+    // Whether length pixels of row y from column x equal the same columns of a source row.
+    bool rowEquals(const std::vector<RGB>& row, int x, int y, int length) const {
+        if (layout == PixelLayout::RowMajor) {
+            return std::equal(row.begin() + x, row.begin() + x + length, data.begin() + static_cast<size_t>(y) * width + x);
+        }
+        for (int col = x; col < x + length; col++) {
+            if (!(data[tiledIndex(col, y)] == row[col])) return false;
+        }
+        return true;
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    bool empty() const { return width == 0 || height == 0; }
+
+    bool isRowMajor() const { return layout == PixelLayout::RowMajor; }
+
+    // Start of row y at column x; row-major storage only, rows are getWidth() pixels apart.
+    const RGB* rowPointer(int x, int y) const { return &data[static_cast<size_t>(y) * width + x]; }
+
+    const RGB& at(int x, int y) const {
+        return layout == PixelLayout::RowMajor ? data[static_cast<size_t>(y) * width + x] : data[tiledIndex(x, y)];
+    }
+
+    // Calls fn(const RGB* run, int length) on contiguous runs that together cover the block
+    // clipped to the image, until fn returns false. Returns false if the scan was stopped.
+    // Tiled storage visits the block tile by tile, and a tile fully inside the block is a single run.
+    template <typename Fn>
+    bool forEachRunWhile(int x, int y, int w, int h, Fn fn) const {
+        int x0 = std::max(0, x), y0 = std::max(0, y);
+        int x1 = std::min(width, x + w), y1 = std::min(height, y + h);
+        if (x0 >= x1 || y0 >= y1) return true;
+
+        if (layout == PixelLayout::RowMajor) {
+            for (int row = y0; row < y1; row++) {
+                if (!fn(&data[static_cast<size_t>(row) * width + x0], x1 - x0)) return false;
+            }
+            return true;
+        }
+
+        for (int ty = y0 >> TILE_SHIFT; ty <= (y1 - 1) >> TILE_SHIFT; ty++) {
+            int rowStart = std::max(y0, ty << TILE_SHIFT);
+            int rowEnd = std::min(y1, (ty + 1) << TILE_SHIFT);
+            for (int tx = x0 >> TILE_SHIFT; tx <= (x1 - 1) >> TILE_SHIFT; tx++) {
+                int colStart = std::max(x0, tx << TILE_SHIFT);
+                int colEnd = std::min(x1, (tx + 1) << TILE_SHIFT);
+                if (colEnd - colStart == TILE_SIZE) {
+                    if (!fn(&data[tiledIndex(colStart, rowStart)], (rowEnd - rowStart) * TILE_SIZE)) return false;
+                } else {
+                    for (int row = rowStart; row < rowEnd; row++) {
+                        if (!fn(&data[tiledIndex(colStart, row)], colEnd - colStart)) return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    template <typename Fn>
+    void forEachRun(int x, int y, int w, int h, Fn fn) const {
+        forEachRunWhile(x, y, w, h, [&fn](const RGB* run, int length) {
+            fn(run, length);
+            return true;
+        });
+    }
+
+    long long countInBlock(int x, int y, int w, int h) const {
+        long long cols = std::min(width, x + w) - std::max(0, x);
+        long long rows = std::min(height, y + h) - std::max(0, y);
+        return cols > 0 && rows > 0 ? cols * rows : 0;
+    }
+};
+
+#endif
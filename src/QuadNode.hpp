@@ -1,34 +1,71 @@
 #ifndef QUADTREE_NODE_HPP
 #define QUADTREE_NODE_HPP
 
-#include <memory>
+#include <algorithm>
+#include <cstdint>
 #include "Image.hpp"
 
-class QuadNode {
-private:
+struct Rect {
     int x, y, width, height;
-    RGB averageColor;
-    bool isLeaf;
-    std::shared_ptr<QuadNode> children[4]; 
-
-public:
-    QuadNode(int x, int y, int w, int h, RGB color, bool leaf): x(x), y(y), width(w), height(h), averageColor(color), isLeaf(leaf) {}
-
-    void setChildren(std::shared_ptr<QuadNode> nw, std::shared_ptr<QuadNode> ne,std::shared_ptr<QuadNode> sw, std::shared_ptr<QuadNode> se) {
-        children[0] = nw;
-        children[1] = ne;
-        children[2] = sw;
-        children[3] = se;
-        isLeaf = false;
+};
+
+inline bool overlaps(const Rect& a, const Rect& b) {
+    return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+// Empty (zero width and height) when the rectangles do not overlap.
+inline Rect intersection(const Rect& a, const Rect& b) {
+    if (!overlaps(a, b)) return {0, 0, 0, 0};
+    int x0 = std::max(a.x, b.x), y0 = std::max(a.y, b.y);
+    int x1 = std::min(a.x + a.width, b.x + b.width), y1 = std::min(a.y + a.height, b.y + b.height);
+    return {x0, y0, x1 - x0, y1 - y0};
+}
+
+// A node's split bits say where its block is divided. The block is cut into units (one pixel
+// unless the tree was scaled up); by default the odd unit of an odd count goes east and south,
+// and flips and quarter turns move it to the west or north.
+const uint8_t ODD_WEST = 1;
+const uint8_t ODD_NORTH = 2;
+const int SPLIT_UNIT_SHIFT = 2;   // the upper six bits hold the unit size minus one
+const int MAX_SPLIT_UNIT = 64;
+
+inline int splitUnit(uint8_t split) {
+    return (split >> SPLIT_UNIT_SHIFT) + 1;
+}
+
+inline uint8_t makeSplit(int unit, bool oddWest, bool oddNorth) {
+    return static_cast<uint8_t>(((unit - 1) << SPLIT_UNIT_SHIFT) | (oddWest ? ODD_WEST : 0) | (oddNorth ? ODD_NORTH : 0));
+}
+
+// Quadrants are NW, NE, SW, SE; the left/top half gets the smaller share of an odd size unless
+// the parent's split bits say otherwise.
+inline Rect childRect(const Rect& parent, int index, uint8_t split = 0) {
+    int halfW = (parent.width + (split & ODD_WEST ? 1 : 0)) / 2;
+    int halfH = (parent.height + (split & ODD_NORTH ? 1 : 0)) / 2;
+    if (split >> SPLIT_UNIT_SHIFT) {
+        int unit = splitUnit(split);
+        halfW = unit * ((parent.width / unit + (split & ODD_WEST ? 1 : 0)) / 2);
+        halfH = unit * ((parent.height / unit + (split & ODD_NORTH ? 1 : 0)) / 2);
     }
+    bool east = index & 1;
+    bool south = index & 2;
+    return {parent.x + (east ? halfW : 0), parent.y + (south ? halfH : 0),
+            east ? parent.width - halfW : halfW, south ? parent.height - halfH : halfH};
+}
+
+// Geometry is implicit: it follows from the parent's rectangle and split bits through childRect.
+// The split bits fill what would otherwise be padding.
+struct QuadNode {
+    RGB color;
+    uint8_t split = 0;         // split bits, only meaningful for internal nodes
+    uint32_t firstChild = 0;   // index of the first of four contiguous children, 0 for a leaf
 
-    int getX() const { return x; }
-    int getY() const { return y; }
-    int getWidth() const { return width; }
-    int getHeight() const { return height; }
-    RGB getColor() const { return averageColor; }
-    bool isLeafNode() const { return isLeaf; }
-    std::shared_ptr<QuadNode> getChild(int index) const { return children[index]; }
+    QuadNode() = default;
+    QuadNode(RGB color, uint32_t firstChild, uint8_t split = 0) : color(color), split(split), firstChild(firstChild) {}
+
+    bool isLeaf() const { return firstChild == 0; }
 };
 
-#endif
\ No newline at end of file
+static_assert(sizeof(QuadNode) == 8, "QuadNode should stay 8 bytes");
+
+#endif
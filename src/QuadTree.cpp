@@ -1,428 +1,966 @@
 #include "QuadTree.hpp"
+#include "Parallel.hpp"
 #include <iostream>
 #include <algorithm>
+#include <climits>
 #include <cmath>
-#include <map>
-#include <unordered_map>
-#include <functional>
 #include <vector>
-#include "gif.h" 
+#include <future>
+#include <thread>
 
 using namespace std;
 
+void TreeStats::addLevel(const QuadNode* levelStart, const Rect* rects, int count) {
+    int levelLeafCount = 0;
+    for (int i = 0; i < count; ++i) {
+        if (!levelStart[i].isLeaf()) continue;
+        levelLeafCount++;
+        long long area = static_cast<long long>(rects[i].width) * rects[i].height;
+        size_t bin = 0;
+        while (area >> (bin + 1)) bin++;
+        if (bin >= leafAreaHistogram.size()) leafAreaHistogram.resize(bin + 1, 0);
+        leafAreaHistogram[bin]++;
+    }
+    levelNodes.push_back(count);
+    levelLeaves.push_back(levelLeafCount);
+    nodes += count;
+    leaves += levelLeafCount;
+    depth++;
+}
+
+void QuadTree::clearTree() {
+    nodes.clear();
+    levelOffsets.clear();
+    stats = TreeStats();
+    nodeSums.clear();
+}
+
+void QuadTree::loadPixels(const std::vector<std::vector<RGB>>& imagePixels) {
+    pixels.load(imagePixels, pixelLayout);
+    imageHeight = pixels.getHeight();
+    imageWidth = pixels.getWidth();
+    pyramid.clear();
+    integral.clear();
+    dispatchMetric(errorMethod, [&](auto metric) {
+        if (usePyramid && decltype(metric)::USES_PYRAMID) pyramid.build(pixels);
+        if (decltype(metric)::USES_INTEGRAL) integral.build(pixels);
+    });
+    pixelsMatchTree = true;
+}
+
 RGB QuadTree::calculateAverage(int x, int y, int width, int height) {
-    double r = 0, g = 0, b = 0;
-    int count = 0;
-    
-    for (int i = y; i < y + height && i < pixels.size(); i++) {
-        for (int j = x; j < x + width && j < pixels[i].size(); j++) {
-            r += pixels[i][j].r;
-            g += pixels[i][j].g;
-            b += pixels[i][j].b;
-            count++;
-        }
+    if (bandCount(pixels.countInBlock(x, y, width, height)) > 1) {
+        return blockMoments(x, y, width, height).average();
     }
-    
-    if (count == 0) return RGB();
-    return RGB(static_cast<uint8_t>(r/count), 
-              static_cast<uint8_t>(g/count), 
-              static_cast<uint8_t>(b/count));
+    return blockAverage(pixels, x, y, width, height);
 }
 
-double QuadTree::calculateError(int x, int y, int width, int height) {
-    RGB avg = calculateAverage(x, y, width, height);
-    int count = 0;
-    double error = 0;
+BlockStats QuadTree::blockMoments(int x, int y, int width, int height) const {
+    BlockStats moments;
+    int bands = bandCount(pixels.countInBlock(x, y, width, height));
+    reduceRowBands(pixels, x, y, width, height, bands, moments, [](BlockStats& band, const RGB* run, int length) {
+        band.addMoments(run, length);
+        return true;
+    });
+    return moments;
+}
 
-    switch(errorMethod) {
-        case 1: { 
-            for (int i = y; i < y + height && i < pixels.size(); i++) {
-                for (int j = x; j < x + width && j < pixels[i].size(); j++) {
-                    error += pow(pixels[i][j].r - avg.r, 2) + pow(pixels[i][j].g - avg.g, 2) + pow(pixels[i][j].b - avg.b, 2);
-                    count++;
-                }
+bool QuadTree::canSplit(int width, int height) const {
+    if (width * height <= minBlockSize) return false;
+    int halfW = width / 2;
+    int halfH = height / 2;
+    if (halfW == 0 || halfH == 0) return false;
+    int remW = width - halfW;
+    int remH = height - halfH;
+    return halfW * halfH >= minBlockSize && remW * halfH >= minBlockSize &&
+           halfW * remH >= minBlockSize && remW * remH >= minBlockSize;
+}
+
+// Tiny blocks inside a row-major image go through the unrolled kernels in SmallBlock.hpp.
+bool QuadTree::fitsSmallKernels(int x, int y, int width, int height) const {
+    return isSmallBlock(width, height) && pixels.isRowMajor() && x >= 0 && y >= 0 &&
+           x + width <= imageWidth && y + height <= imageHeight;
+}
+
+// Estimates the error of a large block from a strided sample. Returns 1 when the confidence
+// interval lies above the threshold, 0 when it lies below, and -1 when only an exact scan can tell.
+template <typename Metric>
+int QuadTree::sampledDecision(int x, int y, int width, int height) {
+    if constexpr (!Metric::SAMPLED) {
+        return -1;
+    } else {
+        if (!sampling.enabled) return -1;
+        long long n = pixels.countInBlock(x, y, width, height);
+        if (n < sampling.minBlockPixels) return -1;
+
+        int x0 = std::max(0, x), y0 = std::max(0, y);
+        int x1 = std::min(imageWidth, x + width), y1 = std::min(imageHeight, y + height);
+        int stride = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(n) / std::max(1, sampling.targetSamples))));
+        int offset = stride / 2;
+
+        std::vector<RGB> sample;
+        sample.reserve(static_cast<size_t>((x1 - x0) / stride + 1) * ((y1 - y0) / stride + 1));
+        long long sum[3] = {0, 0, 0};
+        for (int row = y0 + offset; row < y1; row += stride) {
+            for (int col = x0 + offset; col < x1; col += stride) {
+                const RGB& p = pixels.at(col, row);
+                sample.push_back(p);
+                sum[0] += p.r;
+                sum[1] += p.g;
+                sum[2] += p.b;
             }
-            return count > 0 ? error / (count * 3) : 0;
         }
-        
-        case 2: { 
-            for (int i = y; i < y + height && i < pixels.size(); i++) {
-                for (int j = x; j < x + width && j < pixels[i].size(); j++) {
-                    error += abs(pixels[i][j].r - avg.r) + abs(pixels[i][j].g - avg.g) +abs(pixels[i][j].b - avg.b);
-                    count++;
-                }
-            }
-            return count > 0 ? error / (count * 3) : 0;
+        if (sample.size() < 32) return -1;
+
+        if constexpr (Metric::SAMPLED_RANGE) {
+            // The sampled range can only underestimate the true one.
+            BlockStats range;
+            range.addRange(sample.data(), sample.size());
+            return Metric::exceeds(Metric::fromStats(range), threshold) ? 1 : -1;
         }
-        
-        case 3: {
-            uint8_t minR = 255, maxR = 0, minG = 255, maxG = 0, minB = 255, maxB = 0;
-            bool pixelFound = false;
-            for (int i = y; i < y + height && i < pixels.size(); i++) {
-                for (int j = x; j < x + width && j < pixels[i].size(); j++) {
-                    minR = min(minR, pixels[i][j].r);
-                    maxR = max(maxR, pixels[i][j].r);
-                    minG = min(minG, pixels[i][j].g);
-                    maxG = max(maxG, pixels[i][j].g);
-                    minB = min(minB, pixels[i][j].b);
-                    maxB = max(maxB, pixels[i][j].b);
-                    pixelFound = true;
-                }
+
+        double m = static_cast<double>(sample.size());
+        double mean[3] = {sum[0] / m, sum[1] / m, sum[2] / m};
+        double total = 0, totalSq = 0;
+        for (const RGB& p : sample) {
+            const double c[3] = {static_cast<double>(p.r), static_cast<double>(p.g), static_cast<double>(p.b)};
+            double term = 0;
+            for (int ch = 0; ch < 3; ch++) {
+                double diff = c[ch] - mean[ch];
+                term += Metric::SAMPLED_SQUARED ? diff * diff : std::abs(diff);
             }
-            if (!pixelFound) return 0.0;
-            return ((maxR - minR) + (maxG - minG) + (maxB - minB)) / 3.0;
+            term /= 3.0;
+            total += term;
+            totalSq += term * term;
         }
-        
-        case 4: { 
-            unordered_map<uint8_t, int> histR, histG, histB;
-            int totalPixels = 0;
-            
-            for (int i = y; i < y + height; i++) {
-                for (int j = x; j < x + width; j++) {
-                    histR[pixels[i][j].r]++;
-                    histG[pixels[i][j].g]++; 
-                    histB[pixels[i][j].b]++;
-                    totalPixels++;
-                }
-            }
-            
-            auto calcEntropy = [totalPixels](const auto& hist) {
-                double entropy = 0;
-                for (const auto& pair : hist) {
-                    if (pair.second > 0) {
-                        double p = pair.second / static_cast<double>(totalPixels);
-                        entropy -= p * log2(p);
-                    }
-                }
-                return entropy;
-            };
-            
-            return (calcEntropy(histR) + calcEntropy(histG) + calcEntropy(histB)) / 3.0;
+        double estimate = total / m;
+        double spread = std::sqrt(std::max(0.0, totalSq / m - estimate * estimate) / (m - 1));
+        double low = estimate - sampling.z * spread;
+        double high = estimate + sampling.z * spread;
+
+        if (low > threshold) return 1;
+        if (high < threshold) return 0;
+        return -1;
+    }
+}
+
+template <typename Metric>
+bool QuadTree::shouldSplit(int x, int y, int width, int height) {
+    if (!canSplit(width, height)) return false;
+    if constexpr (Metric::SMALL_BLOCKS) {
+        if (fitsSmallKernels(x, y, width, height)) {
+            const RGB* origin = pixels.rowPointer(x, y);
+            return withSmallWidth(width, [&](auto w) {
+                return Metric::template smallExceeds<decltype(w)::value>(origin, imageWidth, height, threshold);
+            });
         }
+    }
+    // Coarse-to-fine: large blocks that are clearly busy are split from the pyramid alone.
+    if (Metric::USES_PYRAMID && !pyramid.empty()) {
+        BlockStats inner;
+        if (pyramid.innerStats(x, y, width, height, inner) &&
+            Metric::subsetForcesSplit(inner, pixels.countInBlock(x, y, width, height), threshold)) {
+            return true;
+        }
+    }
+    int sampled = sampledDecision<Metric>(x, y, width, height);
+    if (sampled >= 0) return sampled == 1;
+    // The first levels have too few blocks to keep the cores busy; share each scan instead.
+    int bands = bandCount(pixels.countInBlock(x, y, width, height));
+    if (bands > 1) return Metric::bandsExceed({pixels, integral}, x, y, width, height, threshold, bands);
+    return Metric::blockExceeds({pixels, integral}, x, y, width, height, threshold);
+}
 
-        case 5: { 
-            avg = calculateAverage(x, y, width, height);
-            long long totalPixels = 0;
-            double meanOrigR = 0, meanOrigG = 0, meanOrigB = 0;
-            double varOrigR = 0, varOrigG = 0, varOrigB = 0;
-
-            for (int i = y; i < y + height && i < pixels.size(); ++i) {
-                for (int j = x; j < x + width && j < pixels[i].size(); ++j) {
-                    meanOrigR += pixels[i][j].r;
-                    meanOrigG += pixels[i][j].g;
-                    meanOrigB += pixels[i][j].b;
-                    totalPixels++;
-                }
-            }
+// Returns the block's sums so that a parent's average comes from its children without a rescan.
+template <typename Metric>
+BlockStats QuadTree::buildTree(int x, int y, int width, int height, std::vector<QuadNode>& tree, uint32_t index, std::vector<NodeSums>* sums) {
+    BlockStats moments;
+    if (!shouldSplit<Metric>(x, y, width, height)) {
+        if (fitsSmallKernels(x, y, width, height)) {
+            const RGB* origin = pixels.rowPointer(x, y);
+            withSmallWidth(width, [&](auto w) { smallMoments<decltype(w)::value>(origin, imageWidth, height, moments); });
+        } else {
+            pixels.forEachRun(x, y, width, height, [&](const RGB* run, int length) {
+                moments.addMoments(run, length);
+            });
+        }
+        tree[index] = {moments.average(), 0};
+        if (sums) (*sums)[index] = NodeSums::of(moments);
+        return moments;
+    }
 
-            if (totalPixels == 0) return 0.0; 
+    int halfW = width / 2;
+    int halfH = height / 2;
+    int remW = width - halfW;
+    int remH = height - halfH; 
+
+    uint32_t first = tree.size();
+    tree.resize(first + 4);
+    if (sums) sums->resize(first + 4);
+    moments.merge(buildTree<Metric>(x, y, halfW, halfH, tree, first, sums));
+    moments.merge(buildTree<Metric>(x + halfW, y, remW, halfH, tree, first + 1, sums));
+    moments.merge(buildTree<Metric>(x, y + halfH, halfW, remH, tree, first + 2, sums));
+    moments.merge(buildTree<Metric>(x + halfW, y + halfH, remW, remH, tree, first + 3, sums));
+    tree[index] = {moments.average(), first};
+    if (sums) (*sums)[index] = NodeSums::of(moments);
+    return moments;
+}
 
-            meanOrigR /= totalPixels;
-            meanOrigG /= totalPixels;
-            meanOrigB /= totalPixels;
+// Moves a subtree built in its own vector (root at 0) into slot of tree.
+static void appendSubtree(std::vector<QuadNode>& tree, uint32_t slot, const std::vector<QuadNode>& subtree) {
+    uint32_t offset = tree.size() - 1;
+    auto relocate = [offset](QuadNode node) {
+        if (!node.isLeaf()) node.firstChild += offset;
+        return node;
+    };
+    tree[slot] = relocate(subtree[0]);
+    for (size_t i = 1; i < subtree.size(); i++) tree.push_back(relocate(subtree[i]));
+}
 
-            for (int i = y; i < y + height && i < pixels.size(); ++i) {
-                for (int j = x; j < x + width && j < pixels[i].size(); ++j){
-                    double diffR = pixels[i][j].r - meanOrigR;
-                    double diffG = pixels[i][j].g - meanOrigG;
-                    double diffB = pixels[i][j].b - meanOrigB;
-                    varOrigR += diffR * diffR;
-                    varOrigG += diffG * diffG;
-                    varOrigB += diffB * diffB;
-                }
-            }
+template <typename Metric>
+BlockStats QuadTree::buildBottomUp(const Rect& rect, std::vector<QuadNode>& tree, uint32_t index, int parallelDepth) {
+    // MAD and entropy need histograms; below a few hundred pixels rescanning is cheaper than merging 768 bins.
+    bool withHistogram = Metric::HISTOGRAM && rect.width * rect.height >= 3 * 256;
+    BlockStats moments(withHistogram);
+
+    if (!canSplit(rect.width, rect.height)) {
+        pixels.forEachRun(rect.x, rect.y, rect.width, rect.height, [&](const RGB* run, int length) {
+            moments.add(run, length);
+        });
+        tree[index] = {moments.average(), 0};
+        return moments;
+    }
 
-             if (totalPixels > 1) {
-                 varOrigR /= (totalPixels - 1); 
-                 varOrigG /= (totalPixels - 1); 
-                 varOrigB /= (totalPixels - 1); 
-             } else {
-                 varOrigR = varOrigG = varOrigB = 0;
-             }
-
-            double meanCompR = avg.r;
-            double meanCompG = avg.g;
-            double meanCompB = avg.b;
-            const double varCompR = 0.0, varCompG = 0.0, varCompB = 0.0;
-            const double covR = 0.0, covG = 0.0, covB = 0.0;
-
-            const double K1 = 0.01;
-            const double K2 = 0.03;
-            const double L = 255.0; 
-            const double C1 = (K1 * L) * (K1 * L);
-            const double C2 = (K2 * L) * (K2 * L);
-
-            double ssimR = ((2.0 * meanOrigR * meanCompR + C1) * C2) /
-                           ((meanOrigR * meanOrigR + meanCompR * meanCompR + C1) * (varOrigR + varCompR + C2));
-            double ssimG = ((2.0 * meanOrigG * meanCompG + C1) * C2) /
-                           ((meanOrigG * meanOrigG + meanCompG * meanCompG + C1) * (varOrigG + varCompG + C2));
-            double ssimB = ((2.0 * meanOrigB * meanCompB + C1) * C2) /
-                           ((meanOrigB * meanOrigB + meanCompB * meanCompB + C1) * (varOrigB + varCompB + C2));
-
-            double avgSSIM = (ssimR + ssimG + ssimB) / 3.0;
-
-            avgSSIM = std::max(-1.0, std::min(1.0, avgSSIM));
-
-            return 1.0 - avgSSIM;
+    uint32_t first = tree.size();
+    tree.resize(first + 4);
+    BlockStats children[4];
+    if (parallelDepth > 0) {
+        std::vector<QuadNode> subtrees[4];
+        std::future<BlockStats> tasks[4];
+        for (int c = 0; c < 4; c++) {
+            subtrees[c].resize(1);
+            tasks[c] = std::async(std::launch::async, [this, &rect, &subtrees, c, parallelDepth]() {
+                return buildBottomUp<Metric>(childRect(rect, c), subtrees[c], 0, parallelDepth - 1);
+            });
+        }
+        for (int c = 0; c < 4; c++) {
+            children[c] = tasks[c].get();
+            appendSubtree(tree, first + c, subtrees[c]);
+        }
+    } else {
+        for (int c = 0; c < 4; c++) {
+            children[c] = buildBottomUp<Metric>(childRect(rect, c), tree, first + c, 0);
         }
-        
-        default:
-            return 0;
     }
-}
 
-std::shared_ptr<QuadNode> QuadTree::buildTree(int x, int y, int width, int height) {
-    if (width <= 0 || height <= 0) {
-        return nullptr; 
-    }
-    bool makeLeaf = false;
-    if (width * height <= minBlockSize) {
-        makeLeaf = true;
-    } else {
-        double error = calculateError(x, y, width, height);
-        if (errorMethod == 5) { 
-             if (1.0 - error >= threshold) { 
-                 makeLeaf = true;
-             }
-         } else { 
-             if (error <= threshold) {
-                 makeLeaf = true;
-             }
-         }
-    }
-
-    if (!makeLeaf) {
-        int halfW = width / 2;
-        int halfH = height / 2;
-        if (halfW == 0 || halfH == 0) { 
-             makeLeaf = true;
-        } else {
-             int remW = width - halfW;
-             int remH = height - halfH;
-             if ((halfW * halfH < minBlockSize) ||
-                 (remW * halfH < minBlockSize) ||
-                 (halfW * remH < minBlockSize) ||
-                 (remW * remH < minBlockSize))
-             {
-                  makeLeaf = true;
-             }
+    for (int c = 0; c < 4; c++) {
+        if (withHistogram && !children[c].hist) {
+            Rect child = childRect(rect, c);
+            children[c].hist.reset(new std::array<uint32_t, 3 * 256>());
+            pixels.forEachRun(child.x, child.y, child.width, child.height, [&](const RGB* run, int length) {
+                for (int k = 0; k < length; k++) {
+                    (*children[c].hist)[run[k].r]++;
+                    (*children[c].hist)[256 + run[k].g]++;
+                    (*children[c].hist)[512 + run[k].b]++;
+                }
+            });
         }
+        moments.merge(children[c]);
     }
-    if (makeLeaf) {
-        return std::make_shared<QuadNode>(x, y, width, height, calculateAverage(x, y, width, height), true);
+
+    // Metrics that are not mergeable are measured directly; windowed SSIM costs the same
+    // either way with the integral image.
+    double error = 0;
+    if constexpr (Metric::MERGEABLE) {
+        bool rescan = Metric::HISTOGRAM && !withHistogram;
+        error = rescan ? Metric::error({pixels, integral}, rect.x, rect.y, rect.width, rect.height) : Metric::fromStats(moments);
     } else {
-        int halfW = width / 2;
-        int halfH = height / 2;
-        int remW = width - halfW;
-        int remH = height - halfH; 
+        error = Metric::error({pixels, integral}, rect.x, rect.y, rect.width, rect.height);
+    }
 
-        if (halfW <= 0 || halfH <= 0 || remW <= 0 || remH <= 0) { 
-             return std::make_shared<QuadNode>(x, y, width, height, calculateAverage(x, y, width, height), true);
-        }
+    // Children were appended last, so collapsing the block just drops the tail.
+    if (!Metric::exceeds(error, threshold)) {
+        tree.resize(first);
+        tree[index] = {moments.average(), 0};
+    } else {
+        tree[index] = {moments.average(), first};
+    }
+    return moments;
+}
 
-        auto nw = buildTree(x, y, halfW, halfH);
-        auto ne = buildTree(x + halfW, y, remW, halfH);
-        auto sw = buildTree(x, y + halfH, halfW, remH);
-        auto se = buildTree(x + halfW, y + halfH, remW, remH);
-        RGB avgColorForGif = calculateAverage(x, y, width, height);
-        auto node = std::make_shared<QuadNode>(x, y, width, height, avgColorForGif, false);
-        node->setChildren(nw, ne, sw, se);
-        return node;
+void QuadTree::compressBottomUp(const std::vector<std::vector<RGB>>& imagePixels) {
+    clearTree();
+    if (imagePixels.empty() || imagePixels[0].empty()) {
+        return; 
     }
+    loadPixels(imagePixels);
+
+    int parallelDepth = std::thread::hardware_concurrency() > 1 ? 2 : 0;
+    std::vector<QuadNode> tree(1);
+    dispatchMetric(errorMethod, [&](auto metric) {
+        buildBottomUp<decltype(metric)>({0, 0, imageWidth, imageHeight}, tree, 0, parallelDepth);
+    });
+    compact(tree);
 }
 
 void QuadTree::compress(const std::vector<std::vector<RGB>>& imagePixels) {
+    clearTree();
     if (imagePixels.empty() || imagePixels[0].empty()) {
-        root = nullptr;
         return; 
     }
-    pixels = imagePixels;
-    int height = pixels.size();
-    int width = pixels[0].size();
+    loadPixels(imagePixels);
 
-    root = buildTree(0, 0, width, height);
+    std::vector<QuadNode> tree(1);
+    dispatchMetric(errorMethod, [&](auto metric) {
+        buildTree<decltype(metric)>(0, 0, imageWidth, imageHeight, tree, 0);
+    });
+    compact(tree);
 }
 
-void QuadTree::findNodesPerLevel(std::shared_ptr<QuadNode> node, int level,std::map<int, std::vector<std::shared_ptr<QuadNode>>>& nodesMap, int& maxLevelFound) {
-    if (!node) {
-        return; 
+void QuadTree::copySubtree(uint32_t from, std::vector<QuadNode>& tree, std::vector<NodeSums>& sums, uint32_t index) const {
+    const QuadNode& node = nodes[from];
+    sums[index] = nodeSums[from];
+    if (node.isLeaf()) {
+        tree[index] = node;
+        return;
     }
-    nodesMap[level].push_back(node);
-    maxLevelFound = std::max(maxLevelFound, level);
+    uint32_t first = tree.size();
+    tree.resize(first + 4);
+    sums.resize(first + 4);
+    tree[index] = {node.color, first, node.split};
+    for (uint32_t c = 0; c < 4; ++c) copySubtree(node.firstChild + c, tree, sums, first + c);
+}
 
-    if (!node->isLeafNode()) {
-        for (int i = 0; i < 4; ++i) {
-            findNodesPerLevel(node->getChild(i), level + 1, nodesMap, maxLevelFound);
+// One pass over the leaves; children follow their parents in the array, so a backward sweep
+// fills the internal nodes.
+void QuadTree::computeNodeSums() {
+    nodeSums.assign(nodes.size(), NodeSums());
+    for (const NodeRef& leaf : leaves()) {
+        nodeSums[leaf.index] = NodeSums::of(blockMoments(leaf.rect.x, leaf.rect.y, leaf.rect.width, leaf.rect.height));
+    }
+    for (size_t i = nodes.size(); i-- > 0;) {
+        if (nodes[i].isLeaf()) continue;
+        for (uint32_t c = 0; c < 4; ++c) nodeSums[i].add(nodeSums[nodes[i].firstChild + c]);
+    }
+}
+
+// Sums of the old node's block in the updated image: only old leaves that changed are rescanned.
+template <typename Changed>
+NodeSums QuadTree::currentSums(const NodeRef& old, const Changed& changed) const {
+    const Rect& rect = old.rect;
+    if (!changed(rect)) return nodeSums[old.index];
+    if (old.node->isLeaf()) return NodeSums::of(blockMoments(rect.x, rect.y, rect.width, rect.height));
+    NodeSums total;
+    for (int c = 0; c < 4; ++c) total.add(currentSums(childRef(nodes.data(), old, c), changed));
+    return total;
+}
+
+// Decisions only depend on a block's own pixels, so a block with no changed pixels keeps its
+// old subtree and sums. Only the blocks on the way down to a change are decided again.
+template <typename Metric, typename Changed>
+NodeSums QuadTree::rebuildBlock(const NodeRef& old, const Changed& changed, std::vector<QuadNode>& tree, std::vector<NodeSums>& sums, uint32_t index) {
+    const Rect& rect = old.rect;
+    if (!changed(rect)) {
+        copySubtree(old.index, tree, sums, index);
+        return sums[index];
+    }
+    if (old.node->isLeaf()) {
+        sums[index] = NodeSums::of(buildTree<Metric>(rect.x, rect.y, rect.width, rect.height, tree, index, &sums));
+        return sums[index];
+    }
+    NodeSums total;
+    if (!shouldSplit<Metric>(rect.x, rect.y, rect.width, rect.height)) {
+        total = currentSums(old, changed);
+        tree[index] = {total.average(rect), 0};
+    } else {
+        uint32_t first = tree.size();
+        tree.resize(first + 4);
+        sums.resize(first + 4);
+        for (int c = 0; c < 4; ++c) {
+            total.add(rebuildBlock<Metric>(childRef(nodes.data(), old, c), changed, tree, sums, first + c));
         }
+        tree[index] = {total.average(rect), first, old.node->split};
     }
+    sums[index] = total;
+    return total;
 }
 
-void QuadTree::drawNodeArea(std::vector<std::vector<RGB>>& canvas, std::shared_ptr<QuadNode> node) {
-    if (!node) return;
+// Rebuilds the tree from the updated pixels; changed(const Rect&) tells which blocks may differ.
+template <typename Changed>
+void QuadTree::rebuildChanged(const Changed& changed) {
+    std::vector<QuadNode> tree(1);
+    std::vector<NodeSums> sums(1);
+    NodeRef root = {&nodes[0], 0, 0, 0, rootRect()};
+    dispatchMetric(errorMethod, [&](auto metric) {
+        rebuildBlock<decltype(metric)>(root, changed, tree, sums, 0);
+    });
+    compact(tree, &sums);
+}
 
-    RGB color = node->getColor();
-    int startX = node->getX();
-    int startY = node->getY();
-    int nodeWidth = node->getWidth();
-    int nodeHeight = node->getHeight();
+// Whether the stored pixels are the tree's source and can take an image of this size.
+bool QuadTree::matchesPixels(const std::vector<std::vector<RGB>>& imagePixels) const {
+    return !nodes.empty() && pixelsMatchTree && !imagePixels.empty() &&
+           static_cast<int>(imagePixels.size()) == imageHeight && static_cast<int>(imagePixels[0].size()) == imageWidth &&
+           pixels.isRowMajor() == (pixelLayout == PixelLayout::RowMajor);
+}
 
-    int canvasHeight = canvas.size();
-    if (canvasHeight == 0) return;
-    int canvasWidth = canvas[0].size();
-    if (canvasWidth == 0) return;
+void QuadTree::recompressRegion(const std::vector<std::vector<RGB>>& imagePixels, int x, int y, int width, int height) {
+    if (!matchesPixels(imagePixels)) {
+        compress(imagePixels);
+        return;
+    }
+    Rect dirty = intersection({x, y, width, height}, rootRect());
+    if (dirty.width <= 0 || dirty.height <= 0) return;
+    if (nodeSums.size() != nodes.size()) computeNodeSums();
+
+    pixels.update(imagePixels, dirty.x, dirty.y, dirty.width, dirty.height);
+    if (!pyramid.empty()) pyramid.update(pixels, dirty.x, dirty.y, dirty.width, dirty.height);
+    if (!integral.empty()) integral.update(pixels, dirty.x, dirty.y, dirty.width, dirty.height);
+    rebuildChanged([&dirty](const Rect& rect) { return overlaps(rect, dirty); });
+}
 
-    int endY = std::min(startY + nodeHeight, canvasHeight);
-    int endX = std::min(startX + nodeWidth, canvasWidth);
-    startY = std::max(0, startY); 
-    startX = std::max(0, startX);
+FrameDelta QuadTree::compressFrame(const std::vector<std::vector<RGB>>& imagePixels) {
+    FrameDelta delta;
+    if (!matchesPixels(imagePixels)) {
+        compress(imagePixels);
+        return delta;
+    }
+    ChangeMap changes;
+    changes.build(pixels, imagePixels);
+    delta.reused = true;
+    delta.changedTiles = changes.changedTiles();
+    delta.totalTiles = changes.totalTiles();
+    if (delta.changedTiles == 0) return delta;
+    if (nodeSums.size() != nodes.size()) computeNodeSums();
+
+    changes.forEachChangedRun([&](const Rect& run) {
+        pixels.update(imagePixels, run.x, run.y, run.width, run.height);
+        if (!pyramid.empty()) pyramid.update(pixels, run.x, run.y, run.width, run.height);
+        if (!integral.empty()) integral.update(pixels, run.x, run.y, run.width, run.height);
+    });
+    rebuildChanged([&changes](const Rect& rect) { return changes.touches(rect); });
+    return delta;
+}
 
-    for (int y = startY; y < endY; ++y) {
-        for (int x = startX; x < endX; ++x) {
-            canvas[y][x] = color;
+void QuadTree::compact(const std::vector<QuadNode>& tree, const std::vector<NodeSums>* sums) {
+    clearTree();
+    if (tree.empty()) return;
+    nodes.reserve(tree.size());
+    if (sums) nodeSums.reserve(tree.size());
+
+    std::vector<uint32_t> level = {0};
+    std::vector<uint32_t> nextLevel;
+    std::vector<Rect> rects = {{0, 0, imageWidth, imageHeight}};
+    std::vector<Rect> nextRects;
+    while (!level.empty()) {
+        uint32_t levelStart = nodes.size();
+        levelOffsets.push_back(levelStart);
+        uint32_t nextOffset = levelStart + level.size();
+        nextLevel.clear();
+        nextRects.clear();
+        for (size_t i = 0; i < level.size(); ++i) {
+            const QuadNode& node = tree[level[i]];
+            uint32_t firstChild = 0;
+            if (!node.isLeaf()) {
+                firstChild = nextOffset + nextLevel.size();
+                for (uint32_t c = 0; c < 4; ++c) {
+                    nextLevel.push_back(node.firstChild + c);
+                    nextRects.push_back(childRect(rects[i], c, node.split));
+                }
+            }
+            nodes.push_back({node.color, firstChild, node.split});
+            if (sums) nodeSums.push_back((*sums)[level[i]]);
         }
+        stats.addLevel(&nodes[levelStart], rects.data(), level.size());
+        level.swap(nextLevel);
+        rects.swap(nextRects);
     }
+    levelOffsets.push_back(nodes.size());
 }
 
-bool QuadTree::saveGIF(const std::string& filename, int delay, bool dither) {
-   int imgHeight = pixels.size();
-   int imgWidth = pixels[0].size();
+template <typename Metric>
+void QuadTree::buildLinearTree(const Rect& rect, uint64_t path, int level, LinearQuadTree& tree) {
+    if (level >= LinearQuadTree::MAX_LEVEL || !shouldSplit<Metric>(rect.x, rect.y, rect.width, rect.height)) {
+        tree.addLeaf(path, level, calculateAverage(rect.x, rect.y, rect.width, rect.height));
+        return;
+    }
+    for (int c = 0; c < 4; ++c) {
+        buildLinearTree<Metric>(childRect(rect, c), (path << 2) | c, level + 1, tree);
+    }
+}
 
-   std::map<int, std::vector<std::shared_ptr<QuadNode>>> nodesByLevel;
-   int maxDepth = -1;
-   findNodesPerLevel(this->root, 0, nodesByLevel, maxDepth);
+LinearQuadTree QuadTree::compressLinear(const std::vector<std::vector<RGB>>& imagePixels) {
+    clearTree();
+    if (imagePixels.empty() || imagePixels[0].empty()) {
+        return LinearQuadTree();
+    }
+    loadPixels(imagePixels);
 
-   if (maxDepth < 0) {
-       cerr << "Error: Pohon kosong." << endl;
-       return false;
-   }
+    LinearQuadTree tree(imageWidth, imageHeight);
+    dispatchMetric(errorMethod, [&](auto metric) {
+        buildLinearTree<decltype(metric)>({0, 0, imageWidth, imageHeight}, 0, 0, tree);
+    });
+    return tree;
+}
 
-   GifWriter writer = {};
-   int gifDelay = delay / 10; 
-   if (gifDelay < 1) gifDelay = 1;
+LinearQuadTree QuadTree::toLinear() const {
+    LinearQuadTree tree(imageWidth, imageHeight);
+    if (nodes.empty()) return tree;
 
-   if (!GifBegin(&writer, filename.c_str(), imgWidth, imgHeight, gifDelay)) {
-       cerr << "Error: Gagal memulai pembuatan GIF ke " << filename << endl;
-       return false;
-   }
+    // Pre-order, so the nodes come out in Z-order.
+    for (const NodeRef& ref : preOrder()) {
+        if (ref.node->isLeaf()) {
+            tree.addLeaf(ref.path, ref.level, ref.node->color);
+        } else if (ref.node->split != 0) {
+            tree.addSplit(ref.path, ref.level, ref.node->split);
+        }
+    }
+    return tree;
+}
 
-   vector<vector<RGB>> frameCanvas(imgHeight, vector<RGB>(imgWidth));
-   vector<uint8_t> imageBuffer(imgWidth * imgHeight * 4);
+int QuadTree::estimateMaxDepth(int width, int height) const {
+    int depth = 0;
+    while (width * height > minBlockSize) {
+        int halfW = width / 2;
+        int halfH = height / 2;
+        if (halfW == 0 || halfH == 0 || halfW * halfH < minBlockSize) break;
+        width -= halfW;
+        height -= halfH;
+        depth++;
+    }
+    return depth;
+}
 
-   if (nodesByLevel.count(0) && !nodesByLevel[0].empty()) {
-       drawNodeArea(frameCanvas, nodesByLevel[0][0]); 
-   } else {
-       for (auto& row : frameCanvas) std::fill(row.begin(), row.end(), RGB(0, 0, 0));
-   }
+bool QuadTree::buildBreadthFirst(GifFrameWriter* gif) {
+    clearTree();
+
+    std::vector<Rect> blocks = {{0, 0, imageWidth, imageHeight}};
+    std::vector<Rect> levelBlocks[2];
+    std::vector<QuadNode> current;
+    std::vector<char> splits;
+    std::future<bool> rendering;
+    bool renderOk = true;
+
+    for (int depth = 0; !blocks.empty(); ++depth) {
+        current.resize(blocks.size());
+        splits.assign(blocks.size(), 0);
+
+        dispatchMetric(errorMethod, [&](auto metric) {
+            parallelFor(blocks.size(), [&](size_t i) {
+                const Rect& b = blocks[i];
+                splits[i] = shouldSplit<decltype(metric)>(b.x, b.y, b.width, b.height);
+                current[i] = {calculateAverage(b.x, b.y, b.width, b.height), 0};
+            });
+        });
+
+        // The previous level is still being drawn; wait before reusing its buffers.
+        if (rendering.valid()) renderOk = rendering.get() && renderOk;
+
+        uint32_t levelStart = nodes.size();
+        uint32_t nextOffset = levelStart + current.size();
+        std::vector<Rect> nextBlocks;
+        for (size_t i = 0; i < current.size(); ++i) {
+            if (!splits[i]) continue;
+            current[i].firstChild = nextOffset + nextBlocks.size();
+            for (int c = 0; c < 4; ++c) nextBlocks.push_back(childRect(blocks[i], c));
+        }
+        levelOffsets.push_back(levelStart);
+        nodes.insert(nodes.end(), current.begin(), current.end());
+        stats.addLevel(current.data(), blocks.data(), current.size());
+
+        auto& drawn = levelBlocks[depth % 2];
+        drawn.swap(blocks);
+        if (gif) {
+            rendering = std::async(std::launch::async, [this, gif, &drawn, levelStart, depth]() {
+                for (size_t i = 0; i < drawn.size(); ++i) {
+                    const Rect& b = drawn[i];
+                    gif->drawNode(b.x, b.y, b.width, b.height, nodes[levelStart + i].color);
+                }
+                return gif->finishLevel(depth);
+            });
+        }
+        blocks.swap(nextBlocks);
+    }
+    levelOffsets.push_back(nodes.size());
 
-   for (int y = 0; y < imgHeight; ++y) {
-       for (int x = 0; x < imgWidth; ++x) {
-           size_t idx = (y * imgWidth + x) * 4;
-           const RGB& pixel = frameCanvas[y][x];
-           imageBuffer[idx + 0] = pixel.r;
-           imageBuffer[idx + 1] = pixel.g;
-           imageBuffer[idx + 2] = pixel.b;
-           imageBuffer[idx + 3] = 255; 
-       }
-   }
+    if (rendering.valid()) renderOk = rendering.get() && renderOk;
+    return renderOk;
+}
+
+void QuadTree::compressBreadthFirst(const std::vector<std::vector<RGB>>& imagePixels) {
+    if (imagePixels.empty() || imagePixels[0].empty()) {
+        clearTree();
+        return; 
+    }
+    loadPixels(imagePixels);
+    buildBreadthFirst(nullptr);
+}
 
-   if (!GifWriteFrame(&writer, imageBuffer.data(), imgWidth, imgHeight, gifDelay, 8, dither)) {
-        cerr << "Error: Gagal membuat frame awal GIF." << endl;
-        GifEnd(&writer);
+bool QuadTree::compressWithGIF(const std::vector<std::vector<RGB>>& imagePixels, const std::string& filename, int delay, bool dither, const GifOptions& options) {
+    if (imagePixels.empty() || imagePixels[0].empty()) {
+        clearTree();
+        cerr << "Error: Pohon kosong." << endl;
         return false;
-   }
-   for (int level = 1; level <= maxDepth; ++level) {
-       if (nodesByLevel.count(level)) {
-           for (const auto& node : nodesByLevel[level]) {
-               drawNodeArea(frameCanvas, node); 
-           }
-           for (int y = 0; y < imgHeight; ++y) {
-               for (int x = 0; x < imgWidth; ++x) {
-                   size_t idx = (y * imgWidth + x) * 4;
-                   const RGB& pixel = frameCanvas[y][x];
-                   imageBuffer[idx + 0] = pixel.r;
-                   imageBuffer[idx + 1] = pixel.g;
-                   imageBuffer[idx + 2] = pixel.b;
-                   imageBuffer[idx + 3] = 255;
-               }
-           }
-
-           if (!GifWriteFrame(&writer, imageBuffer.data(), imgWidth, imgHeight, gifDelay, 8, dither)) {
-                cerr << "Error: Gagal membuat frame GIF level " << level << "." << endl;
-                GifEnd(&writer);
-                return false;
-           }
-       }
-   }
+    }
+    loadPixels(imagePixels);
 
-   if (!GifEnd(&writer)) {
-       cerr << "Error: Gagal menyelesaikan pembuatan GIF." << endl;
+    GifFrameWriter gif(imageWidth, imageHeight, options);
+    if (!gif.begin(filename, delay, dither, estimateMaxDepth(imageWidth, imageHeight))) {
+        buildBreadthFirst(nullptr);
+        return false;
+    }
+    bool ok = buildBreadthFirst(&gif);
+    if (!gif.end() || !ok) return false;
+
+    cout << "\nGIF berhasil disimpan! (" << gif.getFramesWritten() << " frame)" << endl;
+    return true;
+}
+
+bool QuadTree::saveGIF(const std::string& filename, int delay, bool dither, const GifOptions& options) {
+   if (nodes.empty()) {
+       cerr << "Error: Pohon kosong." << endl;
        return false;
    }
 
-   cout << "\nGIF berhasil disimpan!" << endl;
+   int maxDepth = getDepth() - 1;
+   GifFrameWriter gif(imageWidth, imageHeight, options);
+   if (!gif.begin(filename, delay, dither, maxDepth)) return false;
+
+   bool ok = true;
+   int drawnLevel = 0;
+   for (const NodeRef& ref : breadthFirst()) {
+       if (ref.level != drawnLevel) {
+           ok = ok && gif.finishLevel(drawnLevel);
+           drawnLevel = ref.level;
+       }
+       gif.drawNode(ref.rect.x, ref.rect.y, ref.rect.width, ref.rect.height, ref.node->color);
+   }
+   ok = ok && gif.finishLevel(drawnLevel);
+   if (!ok || !gif.end()) return false;
+
+   cout << "\nGIF berhasil disimpan! (" << gif.getFramesWritten() << " frame)" << endl;
    return true;
 }
 
-std::vector<std::vector<RGB>> QuadTree::reconstructImage() {
-    std::vector<std::vector<RGB>> result(pixels.size(), std::vector<RGB>(pixels[0].size()));
-    
-    std::function<void(std::shared_ptr<QuadNode>)> reconstruct;
-    reconstruct = [&](std::shared_ptr<QuadNode> node) {
-        if (!node) return;
-        
-        if (node->isLeafNode()) {
-            for (int y = node->getY(); y < node->getY() + node->getHeight(); y++) {
-                for (int x = node->getX(); x < node->getX() + node->getWidth(); x++) {
-                    result[y][x] = node->getColor();
-                }
-            }
+static void fillRect(std::vector<std::vector<RGB>>& image, const Rect& rect, RGB color) {
+    for (int y = rect.y; y < rect.y + rect.height; y++) {
+        if (rect.width >= KERNEL_MIN_RUN) {
+            pixelKernels().fill(&image[y][rect.x], rect.width, color);
         } else {
-            for (int i = 0; i < 4; i++) {
-                reconstruct(node->getChild(i));
-            }
+            std::fill(image[y].begin() + rect.x, image[y].begin() + rect.x + rect.width, color);
         }
+    }
+}
+
+std::vector<std::vector<RGB>> QuadTree::reconstructImage() {
+    std::vector<std::vector<RGB>> result(imageHeight, std::vector<RGB>(imageWidth));
+    for (const NodeRef& leaf : leaves()) {
+        fillRect(result, leaf.rect, leaf.node->color);
+    }
+    return result;
+}
+
+std::vector<std::vector<RGB>> QuadTree::reconstructImage(int outWidth, int outHeight, int maxDepth) const {
+    if (nodes.empty() || outWidth <= 0 || outHeight <= 0) return {};
+    std::vector<std::vector<RGB>> result(outHeight, std::vector<RGB>(outWidth));
+
+    // Node edges map to output edges, so the footprints of siblings tile their parent's.
+    auto footprint = [&](const Rect& rect) {
+        int x0 = static_cast<int>(static_cast<long long>(rect.x) * outWidth / imageWidth);
+        int y0 = static_cast<int>(static_cast<long long>(rect.y) * outHeight / imageHeight);
+        int x1 = static_cast<int>(static_cast<long long>(rect.x + rect.width) * outWidth / imageWidth);
+        int y1 = static_cast<int>(static_cast<long long>(rect.y + rect.height) * outHeight / imageHeight);
+        return Rect{x0, y0, x1 - x0, y1 - y0};
     };
-    
-    reconstruct(root);
+    visit([&](const NodeRef& ref) {
+        Rect out = footprint(ref.rect);
+        if (out.width <= 0 || out.height <= 0) return false;
+        bool finest = ref.node->isLeaf() || ref.level == maxDepth || (out.width == 1 && out.height == 1);
+        if (!finest) return true;
+        // Internal nodes hold the average of their block, which stands in for the subtree.
+        fillRect(result, out, ref.node->color);
+        return false;
+    });
     return result;
 }
 
-int QuadTree::countNodes() const {
-    std::function<int(std::shared_ptr<QuadNode>)> count;
-    count = [&](std::shared_ptr<QuadNode> node) {
-        if (!node) return 0;
-        int total = 1;
-        for (int i = 0; i < 4; i++) {
-            total += count(node->getChild(i));
+// Maps destination blocks of a transform to the source: an integer upscale, then a quarter
+// turn or flip of the cropped source, then the crop offset.
+struct TransformMap {
+    int offsetX = 0, offsetY = 0;   // crop origin in the source
+    int width = 0, height = 0;      // cropped source size
+    bool swapAxes = false;          // destination x runs along source y
+    bool flipX = false, flipY = false;
+    int factor = 1;
+
+    static void flipRange(int& lo, int& hi, int size) {
+        int flippedLo = size - hi;
+        hi = size - lo;
+        lo = flippedLo;
+    }
+
+    // Source pixels read by a destination block.
+    Rect toSource(const Rect& dest) const {
+        int u0 = dest.x / factor, u1 = (dest.x + dest.width + factor - 1) / factor;
+        int v0 = dest.y / factor, v1 = (dest.y + dest.height + factor - 1) / factor;
+        int s0 = swapAxes ? v0 : u0, s1 = swapAxes ? v1 : u1;
+        int t0 = swapAxes ? u0 : v0, t1 = swapAxes ? u1 : v1;
+        if (flipX) flipRange(s0, s1, width);
+        if (flipY) flipRange(t0, t1, height);
+        return {offsetX + s0, offsetY + t0, s1 - s0, t1 - t0};
+    }
+
+    // Destination pixels covered by a source block (possibly outside the destination).
+    Rect toDest(const Rect& source) const {
+        int s0 = source.x - offsetX, s1 = s0 + source.width;
+        int t0 = source.y - offsetY, t1 = t0 + source.height;
+        if (flipX) flipRange(s0, s1, width);
+        if (flipY) flipRange(t0, t1, height);
+        int u0 = swapAxes ? t0 : s0, u1 = swapAxes ? t1 : s1;
+        int v0 = swapAxes ? s0 : t0, v1 = swapAxes ? s1 : t1;
+        return {u0 * factor, v0 * factor, (u1 - u0) * factor, (v1 - v0) * factor};
+    }
+};
+
+bool QuadTree::requireTree() const {
+    if (nodes.empty()) {
+        cerr << "Error: Pohon kosong." << endl;
+        return false;
+    }
+    return true;
+}
+
+// Deepest node at or below from whose block contains query.
+static NodeRef containingNode(const QuadNode* nodes, NodeRef from, const Rect& query) {
+    while (!from.node->isLeaf()) {
+        Rect nw = childRect(from.rect, 0, from.node->split);
+        int midX = nw.x + nw.width;
+        int midY = nw.y + nw.height;
+        bool west = query.x + query.width <= midX, east = query.x >= midX;
+        bool north = query.y + query.height <= midY, south = query.y >= midY;
+        if (!(west || east) || !(north || south)) break;
+        from = childRef(nodes, from, (east ? 1 : 0) | (south ? 2 : 0));
+    }
+    return from;
+}
+
+static bool sameRect(const Rect& a, const Rect& b) {
+    return a.x == b.x && a.y == b.y && a.width == b.width && a.height == b.height;
+}
+
+static long long areaOf(const Rect& rect) {
+    return static_cast<long long>(rect.width) * rect.height;
+}
+
+// Where the children of a source node land when its block is carried over whole: quadrant[c]
+// is the destination quadrant of child c, and split the bits that draw the mapped split line in
+// dest. Returns false when no split bits can, e.g. after too many scalings.
+template <typename Map>
+static bool mapSplit(const Map& map, const NodeRef& from, const Rect& dest, int quadrant[4], uint8_t& split) {
+    int unit = splitUnit(from.node->split) * map.factor;
+    if (unit > MAX_SPLIT_UNIT) return false;
+    Rect children[4];
+    for (int c = 0; c < 4; ++c) {
+        children[c] = map.toDest(childRect(from.rect, c, from.node->split));
+        quadrant[c] = (children[c].x > dest.x ? 1 : 0) | (children[c].y > dest.y ? 2 : 0);
+    }
+    Rect nw = children[std::find(quadrant, quadrant + 4, 0) - quadrant];
+    Rect plain = childRect(dest, 0, makeSplit(unit, false, false));
+    split = makeSplit(unit, nw.width != plain.width, nw.height != plain.height);
+    for (int c = 0; c < 4; ++c) {
+        if (!sameRect(childRect(dest, quadrant[c], split), children[c])) return false;
+    }
+    return true;
+}
+
+// Builds the destination block dest into tree[index] from the source subtree under hint and
+// returns its area-weighted moments. A block inside one source leaf becomes that leaf. A block
+// that is the image of a source node takes over its split, with the children permuted and the
+// split bits following the odd unit, so flips, quarter turns and scales keep the tree's shape
+// node for node. Only blocks that straddle source boundaries, as under a crop, are decided
+// again by the metric, over the source leaves they cover.
+template <typename Metric, typename Map>
+BlockStats QuadTree::transformBlock(const QuadNode* source, const Map& map, const Rect& dest, NodeRef hint, std::vector<QuadNode>& tree, uint32_t index) const {
+    BlockStats total;
+    NodeRef inside = containingNode(source, hint, map.toSource(dest));
+    if (inside.node->isLeaf()) {
+        total.addFlat(inside.node->color, areaOf(dest));
+        tree[index] = {inside.node->color, 0};
+        return total;
+    }
+
+    int quadrant[4];
+    uint8_t split = 0;
+    if (sameRect(map.toDest(inside.rect), dest) && mapSplit(map, inside, dest, quadrant, split)) {
+        uint32_t first = tree.size();
+        tree.resize(first + 4);
+        for (int c = 0; c < 4; ++c) {
+            NodeRef child = childRef(source, inside, c);
+            total.merge(transformBlock<Metric>(source, map, map.toDest(child.rect), child, tree, first + quadrant[c]));
         }
+        tree[index] = {total.average(), first, split};
         return total;
-    };
-    return count(root);
+    }
+
+    // A block that covers a whole source node which the pixels made split is split again.
+    BlockStats covered(Metric::HISTOGRAM);
+    bool coversSplit = false;
+    visitSubtree(source, inside, [&](const NodeRef& ref) {
+        Rect image = map.toDest(ref.rect);
+        Rect overlap = intersection(image, dest);
+        if (overlap.width == 0) return false;
+        if (ref.node->isLeaf()) {
+            covered.addFlat(ref.node->color, areaOf(overlap));
+        } else if (sameRect(overlap, image)) {
+            coversSplit = true;
+        }
+        return true;
+    });
+    bool resplit = canSplit(dest.width, dest.height);
+    if (resplit && !coversSplit) {
+        if constexpr (Metric::MERGEABLE) {
+            resplit = Metric::exceeds(Metric::fromStats(covered), threshold);
+        } else {
+            // No stats to decide from; merge only leaves of one color.
+            resplit = !std::equal(covered.minV, covered.minV + 3, covered.maxV);
+        }
+    }
+    if (!resplit) {
+        tree[index] = {covered.average(), 0};
+        return covered;
+    }
+
+    uint32_t first = tree.size();
+    tree.resize(first + 4);
+    for (int c = 0; c < 4; ++c) {
+        total.merge(transformBlock<Metric>(source, map, childRect(dest, c), inside, tree, first + c));
+    }
+    tree[index] = {total.average(), first};
+    return total;
+}
+
+template <typename Map>
+void QuadTree::transformTree(const Map& map, int newWidth, int newHeight) {
+    std::vector<QuadNode> source;
+    source.swap(nodes);
+    NodeRef root = {&source[0], 0, 0, 0, rootRect()};
+    std::vector<QuadNode> tree(1);
+    dispatchMetric(errorMethod, [&](auto metric) {
+        transformBlock<decltype(metric)>(source.data(), map, {0, 0, newWidth, newHeight}, root, tree, 0);
+    });
+    imageWidth = newWidth;
+    imageHeight = newHeight;
+    pixelsMatchTree = false;
+    compact(tree);
+}
+
+bool QuadTree::crop(int x, int y, int width, int height) {
+    if (!requireTree()) return false;
+    Rect area = intersection({x, y, width, height}, rootRect());
+    if (area.width <= 0 || area.height <= 0) {
+        cerr << "Error: Area crop di luar gambar." << endl;
+        return false;
+    }
+    TransformMap map;
+    map.offsetX = area.x;
+    map.offsetY = area.y;
+    map.width = area.width;
+    map.height = area.height;
+    transformTree(map, area.width, area.height);
+    return true;
+}
+
+// Flips and quarter turns of the whole image.
+static TransformMap orientationMap(int width, int height, bool swapAxes, bool flipX, bool flipY) {
+    TransformMap map;
+    map.width = width;
+    map.height = height;
+    map.swapAxes = swapAxes;
+    map.flipX = flipX;
+    map.flipY = flipY;
+    return map;
+}
+
+bool QuadTree::flipHorizontal() {
+    if (!requireTree()) return false;
+    transformTree(orientationMap(imageWidth, imageHeight, false, true, false), imageWidth, imageHeight);
+    return true;
+}
+
+bool QuadTree::flipVertical() {
+    if (!requireTree()) return false;
+    transformTree(orientationMap(imageWidth, imageHeight, false, false, true), imageWidth, imageHeight);
+    return true;
+}
+
+bool QuadTree::rotate90() {
+    if (!requireTree()) return false;
+    transformTree(orientationMap(imageWidth, imageHeight, true, false, true), imageHeight, imageWidth);
+    return true;
+}
+
+bool QuadTree::rotate180() {
+    if (!requireTree()) return false;
+    transformTree(orientationMap(imageWidth, imageHeight, false, true, true), imageWidth, imageHeight);
+    return true;
+}
+
+bool QuadTree::rotate270() {
+    if (!requireTree()) return false;
+    transformTree(orientationMap(imageWidth, imageHeight, true, true, false), imageHeight, imageWidth);
+    return true;
+}
+
+bool QuadTree::scale(int factor) {
+    if (!requireTree()) return false;
+    if (factor < 1 || imageWidth > INT_MAX / factor || imageHeight > INT_MAX / factor) {
+        cerr << "Error: Faktor skala tidak valid." << endl;
+        return false;
+    }
+    if (factor == 1) return true;
+    TransformMap map = orientationMap(imageWidth, imageHeight, false, false, false);
+    map.factor = factor;
+    transformTree(map, imageWidth * factor, imageHeight * factor);
+    return true;
+}
+
+RGB QuadTree::colorAt(int x, int y) const {
+    if (nodes.empty() || x < 0 || y < 0 || x >= imageWidth || y >= imageHeight) return RGB();
+    Rect rect = rootRect();
+    uint32_t index = 0;
+    while (!nodes[index].isLeaf()) {
+        Rect west = childRect(rect, 0, nodes[index].split);
+        int c = (x >= rect.x + west.width ? 1 : 0) | (y >= rect.y + west.height ? 2 : 0);
+        rect = childRect(rect, c, nodes[index].split);
+        index = nodes[index].firstChild + c;
+    }
+    return nodes[index].color;
+}
+
+RGB QuadTree::averageColor(int x, int y, int width, int height) const {
+    Rect query = {x, y, width, height};
+    long long sum[3] = {0, 0, 0};
+    long long area = 0;
+    forEachLeafIn(x, y, width, height, [&](const NodeRef& leaf) {
+        Rect overlap = intersection(leaf.rect, query);
+        long long covered = static_cast<long long>(overlap.width) * overlap.height;
+        sum[0] += covered * leaf.node->color.r;
+        sum[1] += covered * leaf.node->color.g;
+        sum[2] += covered * leaf.node->color.b;
+        area += covered;
+    });
+    if (area == 0) return RGB();
+    return RGB(static_cast<uint8_t>(sum[0] / area), static_cast<uint8_t>(sum[1] / area), static_cast<uint8_t>(sum[2] / area));
+}
+
+int QuadTree::countNodes() const {
+    return stats.nodes;
 }
 
 int QuadTree::countLeaves() const {
-    std::function<int(std::shared_ptr<QuadNode>)> count;
-    count = [&](std::shared_ptr<QuadNode> node) {
-        if (!node) return 0;
-        if (node->isLeafNode()) return 1;
-        int total = 0;
-        for (int i = 0; i < 4; i++) {
-            total += count(node->getChild(i));
-        }
-        return total;
-    };
-    return count(root);
+    return stats.leaves;
 }
 
 int QuadTree::getDepth() const {
-    std::function<int(std::shared_ptr<QuadNode>)> depth;
-    depth = [&](std::shared_ptr<QuadNode> node) {
-        if (!node || node->isLeafNode()) return 1;
-        int maxDepth = 0;
-        for (int i = 0; i < 4; i++) {
-            maxDepth = std::max(maxDepth, depth(node->getChild(i)));
-        }
-        return 1 + maxDepth;
-    };
-    return depth(root);
-}
\ No newline at end of file
+    return stats.depth;
+}
@@ -1,38 +1,185 @@
 #ifndef QUADTREE_HPP
 #define QUADTREE_HPP
 
-#include <memory>
 #include <vector>
 #include <cmath>
-#include <map>
 #include <string>
 #include "QuadNode.hpp"
+#include "NodeIterator.hpp"
 #include "Image.hpp"
+#include "GifFrameWriter.hpp"
+#include "LinearQuadTree.hpp"
+#include "PixelStore.hpp"
+#include "BlockStats.hpp"
+#include "ErrorMetrics.hpp"
+#include "ImagePyramid.hpp"
+#include "IntegralImage.hpp"
+#include "ChangeMap.hpp"
+
+// Opt-in sampled error estimation for large blocks (variance, MAD and max pixel difference).
+struct SamplingOptions {
+    bool enabled = false;
+    long long minBlockPixels = 1 << 16;  // smaller blocks are always scanned exactly
+    int targetSamples = 4096;            // approximate sample size per block
+    double z = 3.0;                      // width of the confidence interval in standard errors
+};
+
+// Shape of the last built tree, recorded level by level as the node array is laid out.
+struct TreeStats {
+    int nodes = 0;
+    int leaves = 0;
+    int depth = 0;                        // number of levels
+    std::vector<int> levelNodes;          // nodes per level
+    std::vector<int> levelLeaves;         // leaves per level
+    std::vector<int> leafAreaHistogram;   // bin k counts leaves of 2^k to 2^(k+1) - 1 pixels
+
+    void addLevel(const QuadNode* levelStart, const Rect* rects, int count);
+};
+
+// Channel sums of a node's block; the pixel count follows from its rectangle.
+struct NodeSums {
+    long long sum[3] = {0, 0, 0};
+
+    static NodeSums of(const BlockStats& stats) { return {{stats.sum[0], stats.sum[1], stats.sum[2]}}; }
+
+    void add(const NodeSums& other) {
+        for (int ch = 0; ch < 3; ch++) sum[ch] += other.sum[ch];
+    }
+
+    // Truncated mean, as BlockStats::average.
+    RGB average(const Rect& rect) const {
+        long long count = static_cast<long long>(rect.width) * rect.height;
+        if (count == 0) return RGB();
+        return RGB(static_cast<uint8_t>(sum[0] / count), static_cast<uint8_t>(sum[1] / count), static_cast<uint8_t>(sum[2] / count));
+    }
+};
+
+// What compressFrame did with a frame of a sequence.
+struct FrameDelta {
+    bool reused = false;       // false when the frame was compressed from scratch
+    int changedTiles = 0;      // ChangeMap tiles that differ from the previous frame
+    int totalTiles = 0;
+};
 
 class QuadTree {
 private:
-    std::shared_ptr<QuadNode> root;
-    std::vector<std::vector<RGB>> pixels;
+    std::vector<QuadNode> nodes;     // breadth-first, children of a node are contiguous
+    std::vector<int> levelOffsets;   // first node of every level, plus a trailing end offset
+    TreeStats stats;
+    int imageWidth = 0;
+    int imageHeight = 0;
+    PixelStore pixels;
+    PixelLayout pixelLayout = PixelLayout::RowMajor;
+    SamplingOptions sampling;
+    bool usePyramid = false;
+    ImagePyramid pyramid;
+    IntegralImage integral;   // only for windowed SSIM
+    bool pixelsMatchTree = false;   // pixels hold the image the tree was built from
+    std::vector<NodeSums> nodeSums; // parallel to nodes, kept once the tree is rebuilt incrementally
     double threshold;
     int minBlockSize;
     int errorMethod;
 
+    void clearTree();
+    void loadPixels(const std::vector<std::vector<RGB>>& imagePixels);
     RGB calculateAverage(int x, int y, int width, int height);
-    double calculateError(int x, int y, int width, int height);
-    std::shared_ptr<QuadNode> buildTree(int x, int y, int width, int height);
+    BlockStats blockMoments(int x, int y, int width, int height) const;
+    bool canSplit(int width, int height) const;
+    bool fitsSmallKernels(int x, int y, int width, int height) const;
+
+    // Builders are templated on an error-metric policy (ErrorMetrics.hpp), chosen once per compress.
+    template <typename Metric> int sampledDecision(int x, int y, int width, int height);
+    template <typename Metric> bool shouldSplit(int x, int y, int width, int height);
+    template <typename Metric> BlockStats buildTree(int x, int y, int width, int height, std::vector<QuadNode>& tree, uint32_t index, std::vector<NodeSums>* sums = nullptr);
+    template <typename Metric> BlockStats buildBottomUp(const Rect& rect, std::vector<QuadNode>& tree, uint32_t index, int parallelDepth);
+    bool matchesPixels(const std::vector<std::vector<RGB>>& imagePixels) const;
+    void computeNodeSums();
+    template <typename Changed> void rebuildChanged(const Changed& changed);
+    template <typename Metric, typename Changed> NodeSums rebuildBlock(const NodeRef& old, const Changed& changed, std::vector<QuadNode>& tree, std::vector<NodeSums>& sums, uint32_t index);
+    template <typename Changed> NodeSums currentSums(const NodeRef& old, const Changed& changed) const;
+    void copySubtree(uint32_t from, std::vector<QuadNode>& tree, std::vector<NodeSums>& sums, uint32_t index) const;
+    template <typename Metric> void buildLinearTree(const Rect& rect, uint64_t path, int level, LinearQuadTree& tree);
+    bool buildBreadthFirst(GifFrameWriter* gif);
+    int estimateMaxDepth(int width, int height) const;
+    void compact(const std::vector<QuadNode>& tree, const std::vector<NodeSums>* sums = nullptr);
+    bool requireTree() const;   // reports an empty tree
+    template <typename Map> void transformTree(const Map& map, int newWidth, int newHeight);
+    template <typename Metric, typename Map> BlockStats transformBlock(const QuadNode* source, const Map& map, const Rect& dest, NodeRef hint, std::vector<QuadNode>& tree, uint32_t index) const;
 
-    void findNodesPerLevel(std::shared_ptr<QuadNode> node, int level,std::map<int, std::vector<std::shared_ptr<QuadNode>>>& nodesMap,int& maxLevelFound);
-void drawNodeArea(std::vector<std::vector<RGB>>& canvas, std::shared_ptr<QuadNode> node);
+    Rect rootRect() const { return {0, 0, imageWidth, imageHeight}; }
    
 public:
     QuadTree(double threshold, int minSize, int method): threshold(threshold), minBlockSize(minSize), errorMethod(method) {}
 
+    void setPixelLayout(PixelLayout layout) { pixelLayout = layout; }
+    void setSampling(const SamplingOptions& options) { sampling = options; }
+    void setUsePyramid(bool enabled) { usePyramid = enabled; }
+
     void compress(const std::vector<std::vector<RGB>>& imagePixels);
+    void compressBottomUp(const std::vector<std::vector<RGB>>& imagePixels);
+    void compressBreadthFirst(const std::vector<std::vector<RGB>>& imagePixels);
+    // Same result as compress(imagePixels) when only the given rectangle changed since the last
+    // compress with the same settings: blocks clear of it keep their subtrees and only the blocks
+    // overlapping it are decided again. Falls back to compress when there is no matching tree.
+    void recompressRegion(const std::vector<std::vector<RGB>>& imagePixels, int x, int y, int width, int height);
+    // Sequence mode: compresses the next frame starting from the current tree. Tiles that differ
+    // from the previous frame are found by comparing pixels, and only blocks touching them are
+    // rebuilt; the result is the same as compress(imagePixels).
+    FrameDelta compressFrame(const std::vector<std::vector<RGB>>& imagePixels);
+    // Builds the leaves straight into a LinearQuadTree, with no node tree. The node tree of this
+    // QuadTree is cleared, because its pixels and size now belong to the new image; compress
+    // again (or keep a toLinear() copy) to use both.
+    LinearQuadTree compressLinear(const std::vector<std::vector<RGB>>& imagePixels);
+    bool compressWithGIF(const std::vector<std::vector<RGB>>& imagePixels, const std::string& filename, int delay = 100, bool dither = false, const GifOptions& options = GifOptions());
 
-    bool saveGIF(const std::string& filename, int delay = 100, bool dither = false);
+    bool saveGIF(const std::string& filename, int delay = 100, bool dither = false, const GifOptions& options = GifOptions());
 
     std::vector<std::vector<RGB>> reconstructImage();
+    // Renders at any output size, no deeper than maxDepth (-1 for no cap). Nodes that cover at
+    // most one output pixel are drawn with their average color instead of being descended.
+    std::vector<std::vector<RGB>> reconstructImage(int outWidth, int outHeight, int maxDepth = -1) const;
+    LinearQuadTree toLinear() const;
     
+    // Traversals (NodeIterator.hpp); each NodeRef carries the node's rectangle, level and Z-order
+    // path. The pre-order ones do not allocate; the level-order ones sweep the level ranges
+    // and keep two levels of rectangles.
+    NodeRange preOrder() const { return NodeRange(NodeCursor(nodes.data(), nodes.size(), rootRect(), NodeCursor::All)); }
+    LevelRange breadthFirst() const { return LevelRange(nodes.data(), levelOffsets, rootRect(), 0, MAX_TREE_DEPTH); }
+    NodeRange leaves() const { return NodeRange(NodeCursor(nodes.data(), nodes.size(), rootRect(), NodeCursor::Leaves)); }
+    LevelRange level(int level) const { return LevelRange(nodes.data(), levelOffsets, rootRect(), level, level); }
+
+    // Pre-order visit; fn(const NodeRef&) may return false to skip the node's children.
+    template <typename Fn>
+    void visit(Fn fn) const { visitNodes(nodes.data(), nodes.size(), rootRect(), fn); }
+
+    // Transforms of the compressed image, done on the tree without reconstructing it. Flips,
+    // quarter turns and scales permute children and adjust each node's split bits, so they are
+    // exact and keep the node count. Crops carry over the blocks that line up with old ones and
+    // decide the blocks straddling old boundaries again with the error method.
+    bool crop(int x, int y, int width, int height);
+    bool flipHorizontal();
+    bool flipVertical();
+    bool rotate90();    // clockwise
+    bool rotate180();
+    bool rotate270();
+    bool scale(int factor);
+
+    // Region queries on the leaves, in O(depth + leaves touched). Outside the image they give black.
+    RGB colorAt(int x, int y) const;
+    RGB averageColor(int x, int y, int width, int height) const;   // area-weighted, truncated
+
+    // Calls fn(const NodeRef& leaf) for every leaf overlapping the rectangle, in Z-order.
+    template <typename Fn>
+    void forEachLeafIn(int x, int y, int width, int height, Fn fn) const {
+        Rect query = {x, y, width, height};
+        visit([&](const NodeRef& ref) {
+            if (!overlaps(ref.rect, query)) return false;
+            if (ref.node->isLeaf()) fn(ref);
+            return true;
+        });
+    }
+
+    const TreeStats& getStats() const { return stats; }
     int countNodes() const;
     int countLeaves() const;
     int getDepth() const;
@@ -0,0 +1,116 @@
+#ifndef SMALL_BLOCK_HPP
+#define SMALL_BLOCK_HPP
+
+#include <algorithm>
+#include <cstdlib>
+#include <type_traits>
+#include <utility>
+#include "BlockStats.hpp"
+#include "Image.hpp"
+
+// Kernels for the tiny blocks near the leaves (both sides at most SMALL_BLOCK_MAX), which make
+// up most of the error evaluations. The block width is a template parameter so that every row
+// is fully unrolled; blocks are read straight from row-major storage without clipping, since
+// the builders only produce blocks inside the image.
+
+const int SMALL_BLOCK_MAX = 8;
+
+template <typename Fn, size_t... I>
+inline void unrollIndices(Fn& fn, std::index_sequence<I...>) {
+    (fn(static_cast<int>(I)), ...);
+}
+
+// Calls fn(0), ..., fn(N - 1) without a loop.
+template <int N, typename Fn>
+inline void unroll(Fn fn) {
+    unrollIndices(fn, std::make_index_sequence<N>());
+}
+
+// Calls fn with std::integral_constant<int, width> for 1 <= width <= SMALL_BLOCK_MAX.
+template <typename Fn>
+inline auto withSmallWidth(int width, Fn fn) {
+    switch (width) {
+        case 1: return fn(std::integral_constant<int, 1>());
+        case 2: return fn(std::integral_constant<int, 2>());
+        case 3: return fn(std::integral_constant<int, 3>());
+        case 4: return fn(std::integral_constant<int, 4>());
+        case 5: return fn(std::integral_constant<int, 5>());
+        case 6: return fn(std::integral_constant<int, 6>());
+        case 7: return fn(std::integral_constant<int, 7>());
+        default: return fn(std::integral_constant<int, 8>());
+    }
+}
+
+inline bool isSmallBlock(int width, int height) {
+    return width >= 1 && height >= 1 && width <= SMALL_BLOCK_MAX && height <= SMALL_BLOCK_MAX;
+}
+
+// Count, sums and sums of squares of a W x height block starting at origin.
+template <int W>
+inline void smallMoments(const RGB* origin, int stride, int height, BlockStats& stats) {
+    long long s0 = 0, s1 = 0, s2 = 0, q0 = 0, q1 = 0, q2 = 0;
+    for (int row = 0; row < height; row++, origin += stride) {
+        const RGB* p = origin;
+        unroll<W>([&](int k) {
+            int r = p[k].r, g = p[k].g, b = p[k].b;
+            s0 += r; s1 += g; s2 += b;
+            q0 += r * r; q1 += g * g; q2 += b * b;
+        });
+    }
+    stats.sum[0] += s0; stats.sum[1] += s1; stats.sum[2] += s2;
+    stats.sumSq[0] += q0; stats.sumSq[1] += q1; stats.sumSq[2] += q2;
+    stats.count += static_cast<long long>(W) * height;
+}
+
+template <int W>
+inline void smallRange(const RGB* origin, int stride, int height, BlockStats& stats) {
+    int lo0 = 255, lo1 = 255, lo2 = 255, hi0 = 0, hi1 = 0, hi2 = 0;
+    for (int row = 0; row < height; row++, origin += stride) {
+        const RGB* p = origin;
+        unroll<W>([&](int k) {
+            int r = p[k].r, g = p[k].g, b = p[k].b;
+            lo0 = std::min(lo0, r); hi0 = std::max(hi0, r);
+            lo1 = std::min(lo1, g); hi1 = std::max(hi1, g);
+            lo2 = std::min(lo2, b); hi2 = std::max(hi2, b);
+        });
+    }
+    stats.minV[0] = std::min<int>(stats.minV[0], lo0);
+    stats.minV[1] = std::min<int>(stats.minV[1], lo1);
+    stats.minV[2] = std::min<int>(stats.minV[2], lo2);
+    stats.maxV[0] = std::max<int>(stats.maxV[0], hi0);
+    stats.maxV[1] = std::max<int>(stats.maxV[1], hi1);
+    stats.maxV[2] = std::max<int>(stats.maxV[2], hi2);
+    stats.count += static_cast<long long>(W) * height;
+}
+
+// Sum of |pixel - mean| over all channels.
+template <int W>
+inline long long smallAbsDeviation(const RGB* origin, int stride, int height, RGB mean) {
+    long long total = 0;
+    for (int row = 0; row < height; row++, origin += stride) {
+        const RGB* p = origin;
+        int rowTotal = 0;
+        unroll<W>([&](int k) {
+            rowTotal += std::abs(p[k].r - mean.r) + std::abs(p[k].g - mean.g) + std::abs(p[k].b - mean.b);
+        });
+        total += rowTotal;
+    }
+    return total;
+}
+
+// Copies the block's channels into values (R values, then G, then B; W * height each).
+template <int W>
+inline void smallChannels(const RGB* origin, int stride, int height, uint8_t* values) {
+    int n = W * height;
+    for (int row = 0; row < height; row++, origin += stride) {
+        const RGB* p = origin;
+        uint8_t* out = values + row * W;
+        unroll<W>([&](int k) {
+            out[k] = p[k].r;
+            out[n + k] = p[k].g;
+            out[2 * n + k] = p[k].b;
+        });
+    }
+}
+
+#endif
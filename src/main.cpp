@@ -4,7 +4,10 @@
 #include <string>
 #include "Image.hpp"
 #include "QuadTree.hpp"
+#include "CpuDispatch.hpp"
 #include <filesystem>
+#include <algorithm>
+#include <vector>
 
 using namespace std;
 using namespace std::chrono;
@@ -40,36 +43,133 @@ bool validateThreshold(int method, double threshold) {
         {0, 255},  
         {0, 255},   
         {0, 8},
-        {0, 1}     
+        {0, 1},
+        {0, 1}
     };
     return threshold >= ranges[method-1].first && threshold <= ranges[method-1].second;
 }
 
-int main() {
+// Images of a directory in name order, the frames of a sequence.
+vector<string> listFrames(const string& dir) {
+    vector<string> frames;
+    for (const auto& entry : fs::directory_iterator(dir)) {
+        if (entry.is_regular_file() && validateImage(entry.path().string())) frames.push_back(entry.path().string());
+    }
+    sort(frames.begin(), frames.end());
+    return frames;
+}
+
+// Sequence mode: every frame starts from the previous frame's tree, and only the blocks
+// touching changed pixels are rebuilt. Frames are saved under the same names in outputDir.
+int compressSequence(const vector<string>& frames, const string& outputDir, double threshold, int minBlock, int method) {
+    fs::create_directories(outputDir);
+    QuadTree quadtree(threshold, minBlock, method);
+    long long totalMs = 0;
+    int prevWidth = 0, prevHeight = 0;
+
+    cout << fixed << setprecision(2) << "\n";
+    for (const string& frame : frames) {
+        Image img;
+        if (!img.loadImg(frame)) {
+            cerr << "Error: Failed to load image " << frame << "\n";
+            return 1;
+        }
+        // compressFrame rebuilds from scratch when the size differs from the previous frame.
+        bool resized = img.getWidth() != prevWidth || img.getHeight() != prevHeight;
+        prevWidth = img.getWidth();
+        prevHeight = img.getHeight();
+        auto start = high_resolution_clock::now();
+        FrameDelta delta = quadtree.compressFrame(img.getPixels());
+        auto end = high_resolution_clock::now();
+        long long ms = duration_cast<milliseconds>(end - start).count();
+        totalMs += ms;
+
+        string outputPath = (fs::path(outputDir) / fs::path(frame).filename()).string();
+        img.saveImg(quadtree.reconstructImage(), outputPath);
+
+        cout << fs::path(frame).filename().string() << " : ";
+        if (delta.reused) {
+            cout << 100.0 * delta.changedTiles / delta.totalTiles << "% changed";
+        } else if (resized && &frame != &frames.front()) {
+            cout << "full compress, size changed to " << img.getWidth() << "x" << img.getHeight();
+        } else {
+            cout << "full compress";
+        }
+        cout << ", " << ms << " ms, " << quadtree.countNodes() << " nodes" << endl;
+    }
+
+    cout << "\n";
+    cout << "------------------------------------------------\n";
+    cout << "|      S E Q U E N C E   R E S U L T S         |\n";
+    cout << "------------------------------------------------\n";
+    cout << "\n";
+    cout << "Frames             : " << frames.size() << endl;
+    cout << "Error threshold    : " << threshold << endl;
+    cout << "Min Block size     : " << minBlock << " pixels" << endl;
+    cout << "Processing time    : " << totalMs << " ms" << endl;
+    cout << "Instruction set    : " << simdLevelName(getSimdLevel()) << endl << endl;
+    return 0;
+}
+
+// Optional --isa=scalar|sse4.2|avx2|avx512 caps the vector kernels, e.g. to test the fallbacks.
+bool applyIsaOverride(int argc, char* argv[]) {
+    const string prefix = "--isa=";
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg.compare(0, prefix.size(), prefix) != 0) {
+            cerr << "Error: Unknown option " << arg << "\n";
+            return false;
+        }
+        SimdLevel level;
+        if (!parseSimdLevel(arg.substr(prefix.size()), level)) {
+            cerr << "Error: Unknown instruction set " << arg.substr(prefix.size()) << "\n";
+            return false;
+        }
+        if (!setSimdLevel(level)) {
+            cerr << "Error: This CPU does not support " << simdLevelName(level) << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (!applyIsaOverride(argc, argv)) return 1;
     printHeader();
 
     string inputPath;
-    cout << "Input image path:\n>> ";
+    cout << "Input image path (a directory compresses its images as a sequence):\n>> ";
     cin >> inputPath;
-    
-    if (!validateImage(inputPath)) return 1;
+
+    vector<string> frames;
+    bool sequence = fs::is_directory(inputPath);
+    if (sequence) {
+        frames = listFrames(inputPath);
+        if (frames.empty()) {
+            cerr << "Error: No images in directory\n";
+            return 1;
+        }
+    } else if (!validateImage(inputPath)) {
+        return 1;
+    }
 
     Image img;
-    if (!img.loadImg(inputPath)) {
+    if (!img.loadImg(sequence ? frames[0] : inputPath)) {
         cerr << "Error: Failed to load image\n";
         return 1;
     }
 
     int method;
-    cout << "\nSelect Error measurement method (1-4):" << endl;
+    cout << "\nSelect Error measurement method (1-6):" << endl;
     cout << "1. Variance (0-65025)" << endl;
     cout << "2. MAD (0-255)" << endl;
     cout << "3. Max Pixel Difference (0-255)" << endl;
     cout << "4. Entropy (0-8)" << endl;
     cout << "5. SSIM (0-1)" << endl;
+    cout << "6. Windowed SSIM (0-1)" << endl;
     cout << ">> ";
     cin >> method;
-    if (method < 1 || method > 5){
+    if (method < 1 || method > 6){
         cerr << "Error: Invalid method selected\n";
         return 1;
     }
@@ -91,8 +191,9 @@ int main() {
     }
 
     string outputPath;
-    cout << "\nOutput image path:\n>> ";
+    cout << (sequence ? "\nOutput directory:\n>> " : "\nOutput image path:\n>> ");
     cin >> outputPath;
+    if (sequence) return compressSequence(frames, outputPath, threshold, minBlock, method);
     fs::create_directories(fs::path(outputPath).parent_path());
 
     string gifPath;
@@ -100,29 +201,64 @@ int main() {
     cin.ignore(); 
     getline(cin, gifPath);
 
-    auto start = high_resolution_clock::now();
-    
-    QuadTree quadtree(threshold, minBlock, method);
-    
-    quadtree.compress(img.getPixels());
-    auto compressedImg = quadtree.reconstructImage();
-    img.saveImg(compressedImg, outputPath);
-    
-    auto end = high_resolution_clock::now();
-    auto duration = duration_cast<milliseconds>(end - start);
+    GifOptions gifOptions;
+    if (!gifPath.empty()) {
+        cout << "\nMaximum GIF frames (0 = no limit):\n>> ";
+        cin >> gifOptions.maxFrames;
+        if (gifOptions.maxFrames < 0) {
+            cerr << "Error: Invalid maximum GIF frames\n";
+            return 1;
+        }
+
+        double minChangedPercent;
+        cout << "\nMinimum changed pixels per GIF frame (0-100 %):\n>> ";
+        cin >> minChangedPercent;
+        if (minChangedPercent < 0 || minChangedPercent > 100) {
+            cerr << "Error: Invalid minimum changed pixels\n";
+            return 1;
+        }
+        gifOptions.minChangedFraction = minChangedPercent / 100.0;
+
+        char skip;
+        cout << "\nSkip GIF frames with no visible change (y/n):\n>> ";
+        cin >> skip;
+        gifOptions.skipUnchanged = (skip == 'y' || skip == 'Y');
+
+        cout << "\nMaximum GIF dimension in pixels (0 = original size):\n>> ";
+        cin >> gifOptions.maxDimension;
+        if (gifOptions.maxDimension < 0) {
+            cerr << "Error: Invalid maximum GIF dimension\n";
+            return 1;
+        }
+    }
 
     if (!gifPath.empty()) {
-        cout << "\nSaving compression process GIF..." << endl;
         try { 
              fs::create_directories(fs::path(gifPath).parent_path());
         } catch (const fs::filesystem_error& e) {
              cerr << "Warning: Could not create directories for GIF: " << e.what() << endl;
         }
+    }
+
+    auto start = high_resolution_clock::now();
+    
+    QuadTree quadtree(threshold, minBlock, method);
+    
+    if (gifPath.empty()) {
+        quadtree.compress(img.getPixels());
+    } else {
+        // The GIF frames are encoded level by level while the tree is being built.
+        cout << "\nSaving compression process GIF..." << endl;
         int gifDelay = 400; 
-        if (!quadtree.saveGIF(gifPath, gifDelay)) {
+        if (!quadtree.compressWithGIF(img.getPixels(), gifPath, gifDelay, false, gifOptions)) {
             cerr << "Error: Failed to save compression GIF to " << gifPath << endl;
         }
     }
+    auto compressedImg = quadtree.reconstructImage();
+    img.saveImg(compressedImg, outputPath);
+    
+    auto end = high_resolution_clock::now();
+    auto duration = duration_cast<milliseconds>(end - start);
 
     size_t originalSize = img.getFileSize(inputPath);
     size_t compressedSize = img.getFileSize(outputPath);
@@ -140,6 +276,7 @@ int main() {
     cout << "Error threshold    : " << threshold << endl;
     cout << "Min Block size     : " << minBlock << " pixels" << endl;
     cout << "Processing time    : " << duration.count() << " ms" << endl;
+    cout << "Instruction set    : " << simdLevelName(getSimdLevel()) << endl;
     cout << "Quadtree nodes     : " << quadtree.countNodes() << endl;
     cout << "Leaf nodes         : " << quadtree.countLeaves() << endl;
     cout << "Tree depth         : " << quadtree.getDepth() << endl << endl;
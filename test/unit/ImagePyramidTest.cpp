@@ -0,0 +1,60 @@
+// Checks which pyramid level innerStats reads and that its sums match the pixels it covers.
+#include <iostream>
+#include <vector>
+#include "ImagePyramid.hpp"
+
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool ok, const string& what) {
+    if (!ok) {
+        cerr << "FAIL: " << what << endl;
+        failures++;
+    }
+}
+
+// Expects the cells of the given size covered by the block, or no stats when cellSize is 0.
+static void checkBlock(const ImagePyramid& pyramid, const vector<vector<RGB>>& pixels, int x, int y, int w, int h, int cellSize) {
+    string name = "block " + to_string(x) + "," + to_string(y) + " " + to_string(w) + "x" + to_string(h);
+    BlockStats stats;
+    bool found = pyramid.innerStats(x, y, w, h, stats);
+    check(found == (cellSize > 0), name + ": unexpected result");
+    if (!found || cellSize == 0) return;
+
+    int x0 = (x + cellSize - 1) / cellSize * cellSize, y0 = (y + cellSize - 1) / cellSize * cellSize;
+    int x1 = (x + w) / cellSize * cellSize, y1 = (y + h) / cellSize * cellSize;
+    long long sum = 0;
+    for (int row = y0; row < y1; row++) {
+        for (int col = x0; col < x1; col++) sum += pixels[row][col].r;
+    }
+    check(stats.count == static_cast<long long>(x1 - x0) * (y1 - y0), name + ": wrong level (count " + to_string(stats.count) + ")");
+    check(stats.sum[0] == sum, name + ": wrong sum");
+}
+
+int main() {
+    const int width = 256, height = 192;
+    vector<vector<RGB>> pixels(height, vector<RGB>(width));
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) pixels[y][x] = RGB((x * 7 + y * 13) & 255, (x ^ y) & 255, (x * y) & 255);
+    }
+    PixelStore store;
+    store.load(pixels, PixelLayout::RowMajor);
+    ImagePyramid pyramid;
+    pyramid.build(store);
+
+    // The coarsest level with at least 8 cells across the shorter side.
+    checkBlock(pyramid, pixels, 0, 0, 256, 192, 16);
+    checkBlock(pyramid, pixels, 0, 0, 200, 180, 16);
+    checkBlock(pyramid, pixels, 5, 3, 130, 127, 8);
+    checkBlock(pyramid, pixels, 0, 0, 128, 128, 16);
+    checkBlock(pyramid, pixels, 64, 64, 64, 64, 8);
+    checkBlock(pyramid, pixels, 0, 0, 63, 100, 0);
+
+    if (failures > 0) {
+        cerr << failures << " check(s) failed" << endl;
+        return 1;
+    }
+    cout << "ImagePyramidTest passed" << endl;
+    return 0;
+}
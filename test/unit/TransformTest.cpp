@@ -0,0 +1,128 @@
+// Checks the tree transforms: every lookup path must agree with the reconstruction, no leaf may
+// be empty, and flips and quarter turns must be exact and keep the node count.
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "QuadTree.hpp"
+
+using namespace std;
+
+typedef vector<vector<RGB>> Pixels;
+
+static int failures = 0;
+
+static void check(bool ok, const string& what) {
+    if (!ok) {
+        cerr << "FAIL: " << what << endl;
+        failures++;
+    }
+}
+
+static Pixels testImage(int width, int height) {
+    Pixels pixels(height, vector<RGB>(width));
+    unsigned seed = 12345;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            seed = seed * 1103515245u + 12345u;
+            uint8_t noise = (seed >> 16) & 15;
+            bool block = (x / 13 + y / 7) % 3 == 0;
+            pixels[y][x] = RGB(block ? 200 : x * 2 + noise, block ? 40 : y * 3, (x * y) & 255);
+        }
+    }
+    return pixels;
+}
+
+static Pixels flipH(const Pixels& p) {
+    Pixels out = p;
+    for (auto& row : out) reverse(row.begin(), row.end());
+    return out;
+}
+
+static Pixels flipV(const Pixels& p) {
+    return Pixels(p.rbegin(), p.rend());
+}
+
+static Pixels rotate90(const Pixels& p) {
+    int width = p[0].size(), height = p.size();
+    Pixels out(width, vector<RGB>(height));
+    for (int y = 0; y < width; y++) {
+        for (int x = 0; x < height; x++) out[y][x] = p[height - 1 - x][y];
+    }
+    return out;
+}
+
+// Every leaf is non-empty, and colorAt of the tree and of its linear form match the reconstruction.
+static void checkConsistent(const QuadTree& tree, Pixels reconstructed, const string& name) {
+    int leaves = 0;
+    bool empty = false;
+    for (const NodeRef& leaf : tree.leaves()) {
+        leaves++;
+        if (leaf.rect.width <= 0 || leaf.rect.height <= 0) empty = true;
+    }
+    check(!empty, name + ": empty leaf");
+    check(leaves == tree.countLeaves(), name + ": countLeaves " + to_string(tree.countLeaves()) + ", walked " + to_string(leaves));
+
+    LinearQuadTree linear = tree.toLinear();
+    check(static_cast<int>(linear.size()) == leaves, name + ": linear leaf count");
+    check(linear.reconstructImage() == reconstructed, name + ": linear reconstruction");
+    int wrongTree = 0, wrongLinear = 0;
+    for (int y = 0; y < static_cast<int>(reconstructed.size()); y++) {
+        for (int x = 0; x < static_cast<int>(reconstructed[y].size()); x++) {
+            if (!(tree.colorAt(x, y) == reconstructed[y][x])) wrongTree++;
+            if (!(linear.colorAt(x, y) == reconstructed[y][x])) wrongLinear++;
+        }
+    }
+    check(wrongTree == 0, name + ": QuadTree::colorAt wrong for " + to_string(wrongTree) + " pixels");
+    check(wrongLinear == 0, name + ": LinearQuadTree::colorAt wrong for " + to_string(wrongLinear) + " pixels");
+}
+
+// Flips and quarter turns: exact, and the same number of nodes.
+static void checkOrientation(int method, double threshold, const Pixels& image, const string& name,
+                             bool (QuadTree::*transform)(), Pixels (*expected)(const Pixels&)) {
+    QuadTree tree(threshold, 1, method);
+    tree.compress(image);
+    Pixels before = tree.reconstructImage();
+    int nodes = tree.countNodes();
+    check((tree.*transform)(), name + ": transform failed");
+    Pixels after = tree.reconstructImage();
+    check(after == expected(before), name + ": not exact");
+    check(tree.countNodes() == nodes, name + ": " + to_string(nodes) + " nodes became " + to_string(tree.countNodes()));
+    checkConsistent(tree, after, name);
+}
+
+static Pixels rotate180(const Pixels& p) { return flipV(flipH(p)); }
+static Pixels rotate270(const Pixels& p) { return rotate90(rotate90(rotate90(p))); }
+
+int main() {
+    Pixels image = testImage(101, 67);
+    const double thresholds[] = {0, 100, 20, 15, 0.5, 0.3};
+
+    for (int method = 1; method <= 6; method++) {
+        string prefix = "method " + to_string(method) + " ";
+        double threshold = thresholds[method - 1];
+        checkOrientation(method, threshold, image, prefix + "flipHorizontal", &QuadTree::flipHorizontal, flipH);
+        checkOrientation(method, threshold, image, prefix + "flipVertical", &QuadTree::flipVertical, flipV);
+        checkOrientation(method, threshold, image, prefix + "rotate90", &QuadTree::rotate90, rotate90);
+        checkOrientation(method, threshold, image, prefix + "rotate180", &QuadTree::rotate180, rotate180);
+        checkOrientation(method, threshold, image, prefix + "rotate270", &QuadTree::rotate270, rotate270);
+
+        QuadTree tree(threshold, 1, method);
+        tree.compress(image);
+        check(tree.crop(7, 5, 61, 43), prefix + "crop failed");
+        checkConsistent(tree, tree.reconstructImage(), prefix + "crop");
+        check(tree.scale(3), prefix + "scale failed");
+        checkConsistent(tree, tree.reconstructImage(), prefix + "crop + scale");
+        check(tree.rotate90() && tree.flipHorizontal(), prefix + "rotate + flip failed");
+        checkConsistent(tree, tree.reconstructImage(), prefix + "crop + scale + rotate + flip");
+        check(tree.crop(10, 9, 50, 77), prefix + "second crop failed");
+        checkConsistent(tree, tree.reconstructImage(), prefix + "second crop");
+    }
+
+    if (failures > 0) {
+        cerr << failures << " check(s) failed" << endl;
+        return 1;
+    }
+    cout << "TransformTest passed" << endl;
+    return 0;
+}